@@ -13,6 +13,11 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 // Different operating systems have different functions for accessing files.
 // Use macro definition to set a function for windows that behaves the same as the POSIX one.
@@ -21,8 +26,34 @@ inline int access(const char *pathname, int mode)
 {
 	return _access(pathname, mode);
 }
+// Windows has stat but not the macro to check if it found a folder.
+#define S_ISDIR(mode) (((mode) & S_IFMT) == S_IFDIR)
+// Files larger than 2 GB need 64 bit offsets to seek in.
+#define fseeko _fseeki64
+#define ftello _ftelli64
+// stdin and stdout are opened in text mode on Windows, which changes line endings in binary data.
+#include <io.h>
+#include <fcntl.h>
 #else
 #include <unistd.h>
+// Folders are read with dirent, which Windows doesn't have, so batch conversion of folders is only available
+// on other operating systems.
+#include <dirent.h>
+#include <strings.h>
+// Threads use pthreads, which Windows doesn't have. Work that is split over threads runs
+// on the calling thread on Windows instead.
+#include <pthread.h>
+// The daemon uses Unix domain sockets, and its benchmark starts processes with posix_spawn,
+// so it is also only available on other operating systems.
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+// Files are mapped into memory so uncompressed images can be encoded without reading them into a buffer.
+#include <fcntl.h>
+#include <sys/mman.h>
+extern char **environ;
 #endif
 
 // Importing the STB Image library to handle png and jpeg decoding.
@@ -30,6 +61,43 @@ inline int access(const char *pathname, int mode)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// SSE2 is available on every x86-64 processor. Other processors use the plain C version of each kernel.
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// GCC and Clang can also compile AVX2 versions of some kernels, which are chosen at runtime when the processor supports them.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+// The instruction sets a kernel can be written for. Kernels with a runtime choice use the best one the processor supports.
+#define KERNEL_PLAIN 0
+#define KERNEL_SSE2 1
+#define KERNEL_AVX2 2
+
+// Checks if the processor running the program supports AVX2, for kernels compiled for it alongside their SSE2 version.
+// Only GCC and Clang can compile a function for an instruction set the rest of the program is not built for.
+bool hasAVX2()
+{
+#ifdef AVX2_DISPATCH
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+// The best kernel the processor supports.
+int getBestKernel()
+{
+#ifdef __SSE2__
+	return hasAVX2() ? KERNEL_AVX2 : KERNEL_SSE2;
+#else
+	return KERNEL_PLAIN;
+#endif
+}
+
 struct Pixel
 {
 	unsigned char r;
@@ -43,7 +111,22 @@ struct InputImage
 	unsigned int width;
 	unsigned int height;
 	char *fileLocation;
+	// RGBA pixels, used for images with 3 or 4 channels.
+	// NULL when the image is kept in its original samples instead.
 	struct Pixel *pixels;
+	// The samples exactly as they were loaded by stb_image, used for images with 1 (gray) or 2 (gray, alpha) channels
+	// so they don't have to be expanded to 4 times the size. NULL when pixels is used.
+	unsigned char *samples;
+	// The samples of a 16 bit image as loaded by stb_image. These are reduced to 8 bits
+	// while encoding so that no 8 bit copy of the image is needed. NULL for 8 bit images.
+	unsigned short *samples16;
+	// The samples of a high dynamic range (.hdr) image as loaded by stb_image. These are tonemapped
+	// to 8 bits while encoding. NULL for other images.
+	float *samplesHDR;
+	int channels;
+	// The EXIF orientation of a JPEG (1 to 8), which says how its stored pixels are turned to show it upright.
+	// 1 for images that are stored upright, which is every other format.
+	int orientation;
 };
 
 struct OutputImage
@@ -52,7 +135,119 @@ struct OutputImage
 	unsigned int height;
 	char *fileLocation;
 	char *data;
-	unsigned int dataSize;
+	size_t dataSize;
+	// The size allocated for data. An output image that already has a large enough data array
+	// is encoded into it again instead of allocating a new one.
+	size_t dataCapacity;
+	// When set, encoded bytes are written to this stream as they are produced instead of being
+	// kept for exportQOI. The data array then only needs to hold one chunk of the file.
+	FILE *stream;
+};
+
+// The ways 16 bit samples can be reduced to the 8 bits stored by QOI.
+enum DownConversion
+{
+	// Drop the fractional part of the scaled value.
+	DOWN_CONVERSION_TRUNCATE,
+	// Round the scaled value to the closest 8 bit value.
+	DOWN_CONVERSION_ROUND,
+	// Add a 4x4 ordered (Bayer) dither before dropping the fractional part, avoiding banding in gradients.
+	DOWN_CONVERSION_DITHER
+};
+
+// The ways high dynamic range values (0 to infinity) can be mapped into 0 to 1.
+enum Tonemap
+{
+	// Values above 1 are clamped to 1.
+	TONEMAP_CLAMP,
+	// x / (1 + x), which compresses bright values while leaving dark values almost unchanged.
+	TONEMAP_REINHARD,
+	// Krzysztof Narkowicz's fit of the ACES filmic curve.
+	TONEMAP_ACES
+};
+
+// How an image is filtered when it's resized.
+enum ResizeFilter
+{
+	// Average every source pixel each output pixel covers.
+	RESIZE_BOX,
+	// Blend the 4 source pixels nearest the centre of each output pixel.
+	RESIZE_BILINEAR
+};
+
+// The ways the alpha of each pixel can be applied to its color while it's encoded.
+enum AlphaTransform
+{
+	// Keep the pixels as they are.
+	ALPHA_KEEP,
+	// Set the color of fully transparent pixels to black. Whatever color was left in them can't be seen, but breaks
+	// up runs and running array hits.
+	ALPHA_CLEAR,
+	// Multiply the color by the alpha, for images that are drawn premultiplied. Transparent pixels also become black.
+	ALPHA_PREMULTIPLY,
+	// Divide the color by the alpha, for images that were stored premultiplied.
+	ALPHA_UNPREMULTIPLY
+};
+
+// A rectangle of pixels within an image.
+struct Rectangle
+{
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+// The most widths an image can be saved at in one conversion.
+#define MAX_OUTPUT_SIZES 16
+
+// Settings that change how an image is imported or encoded.
+struct Options
+{
+	enum DownConversion downConversion;
+	enum Tonemap tonemap;
+	// Save high dynamic range images without gamma and mark them as linear in the header.
+	bool linear;
+	// The number of times the conversion is timed for a benchmark. 0 when no benchmark is run.
+	int benchmarkIterations;
+	// Save every frame of an animated GIF to its own numbered file.
+	bool frames;
+	// Only save the rectangles of each frame that changed from the frame before, with an index of where they go.
+	bool delta;
+	// When converting a folder, check the contents of unchanged files against the manifest instead of only their size and modified time.
+	bool verify;
+	// Decode JPEGs at 1/2, 1/4 or 1/8 size while their longer side stays at least this many pixels. 0 for full size.
+	int targetSize;
+	// Resize images to this size before encoding. A side of 0 keeps the aspect ratio, both 0 keeps the original size.
+	int resizeWidth;
+	int resizeHeight;
+	enum ResizeFilter resizeFilter;
+	// Save the image at each of these widths instead of once, each to <destination>_<width>.
+	int outputWidths[MAX_OUTPUT_SIZES];
+	int outputWidthCount;
+	// Only encode this rectangle of the image. A width of 0 encodes the whole image.
+	struct Rectangle crop;
+	// Encode the image upside down. A crop is taken from the flipped image.
+	bool flip;
+	// Encode JPEGs as they are stored instead of turning them upright by their EXIF orientation.
+	bool ignoreOrientation;
+	// How the alpha of each pixel is applied to its color while it's encoded.
+	enum AlphaTransform alphaTransform;
+	// Read raw and PNM sources a batch of rows at a time, and write the destination as it is encoded, so images
+	// larger than memory can be converted.
+	bool stream;
+	// Read the source as pixels with no header, of this size and pixel format. A width of 0 reads image files.
+	int rawWidth;
+	int rawHeight;
+	const struct PixelFormat *pixelFormat;
+	// The number of threads used for work that can be split up, such as the frames of a GIF.
+	int threadCount;
+	// The socket to listen on as a daemon. NULL when not running as a daemon.
+	char *daemonLocation;
+	// The socket of a daemon to send the conversion to, instead of converting it in this process. NULL to convert here.
+	char *connectLocation;
+	// The location this program was started from, used to start it again for benchmarks.
+	char *executableLocation;
 };
 
 void waitForInput()
@@ -95,7 +290,8 @@ int withinWrappedRange(int original, int comparison, int minOffset, int maxOffse
 
 	// Otherwise, check if the original is close enough to 0 for wrapping below 0 to be possible.
 	// If it is, then add 256 to the minimum value to wrap the original to above 255.
-	if (original - minOffset < 0 && comparison >= 256 + (original - minOffset))
+	// The maximum is also checked as the original may be outside of 0 to 255 (OP_LUMA adds dg to it).
+	if (original - minOffset < 0 && comparison >= 256 + (original - minOffset) && comparison <= 256 + original + maxOffset)
 	{
 		// Over Wrapped Min
 		// Return the difference, accounting for the wrapping.
@@ -105,7 +301,7 @@ int withinWrappedRange(int original, int comparison, int minOffset, int maxOffse
 	// Otherwise do the same thing for wrapping the original value above 255.
 	// If the original is close enough to 255, check that if 256 was subtracted
 	// would the comparison value be within the range.
-	if (original + maxOffset > 255 && comparison <= original + maxOffset - 256)
+	if (original + maxOffset > 255 && comparison <= original + maxOffset - 256 && comparison >= original - minOffset - 256)
 	{
 		// Under Wrapped Max
 		// Return the difference, accounting for the wrapping.
@@ -143,7 +339,7 @@ void writeIntToByteArray(char *bytes, int index, int value)
 }
 
 // Saves a run of pixels to the data of the output image.
-void saveRun(char *data, unsigned char *run, int *dataIndex)
+void saveRun(char *data, unsigned char *run, size_t *dataIndex)
 {
 	// A run is used when there are multiple pixels of the same value in a row.
 	// The first pixel is saved with a different operation and subsequent pixels are
@@ -166,13 +362,16 @@ void saveRun(char *data, unsigned char *run, int *dataIndex)
 	*run = 0;
 }
 
-void convertToQOI(struct InputImage *inputImage, struct OutputImage *outputImage)
+// Holds everything the encoder needs to remember between pixels.
+// Keeping this in one struct allows the same pixel operations to be used by every input kernel
+// (RGBA pixels, grayscale samples, etc.) without each kernel needing its own copy of the loop state.
+struct EncoderState
 {
-	// There are 14 bytes in the header and 8 in the the footer.
-	// 5 bytes is the largest possible size of one pixel.
-	// Therefore 5 * the number of pixels + 22 is the maximum size of the array.
-	outputImage->data = malloc(5 * inputImage->height * inputImage->width + 22);
-
+	char *data;
+	// Sizes are 64 bit, as the output of an image of more than 400 megapixels can be over 2 GB.
+	size_t dataIndex;
+	unsigned char run;
+	struct Pixel prevPixel;
 	// The running array is used to hold recently used pixel. It behaves as follows:
 	// Every pixel can be hashed using the function getQOIHash to get the corresponding index
 	// for that pixel value. Each pixel after it is written to the data will be saved at the index.
@@ -182,365 +381,7664 @@ void convertToQOI(struct InputImage *inputImage, struct OutputImage *outputImage
 	// the current pixel. If so then a pixel can be saved in 1 byte.
 	// This array does not have to be saved with the file as it is reconstructed in the same way when decoding the
 	// file.
-	// The array is allocated the size of 64 pixels.
-	struct Pixel *runningArray = malloc(sizeof(struct Pixel) * 64);
+	struct Pixel runningArray[64];
+	// The stream that full chunks of data are written to, or NULL if the whole file is kept in data.
+	FILE *stream;
+	// The number of bytes already written to the stream.
+	size_t streamedSize;
+	// How the alpha of each pixel is applied to its color by the row kernels. Set from the options after startQOI,
+	// which starts it as ALPHA_KEEP.
+	enum AlphaTransform alphaTransform;
+};
+
+// Encoded data is written to a stream once this many bytes are waiting.
+// Large enough that each fwrite is worthwhile, small enough to stay in cache.
+#define STREAM_CHUNK_SIZE 65536
+
+// Allocates the output data and writes the QOI header.
+// Channels is the value written to the header (3 = RGB, 4 = RGBA).
+// Colorspace is the value written to the header (0 = sRGB, 1 = linear).
+void startQOI(struct EncoderState *state, struct OutputImage *outputImage, unsigned int width, unsigned int height, unsigned char channels, unsigned char colorspace)
+{
+	outputImage->width = width;
+	outputImage->height = height;
+	outputImage->fileLocation = NULL;
+
+	// There are 14 bytes in the header and 8 in the the footer.
+	// 5 bytes is the largest possible size of one pixel.
+	// Therefore 5 * the number of pixels + 22 is the maximum size of the array.
+	size_t maxSize = 5 * (size_t)height * width + 22;
+	// A streamed image is flushed at the end of each row once a chunk is waiting,
+	// so the data array only has to fit a chunk and one more row.
+	if (outputImage->stream != NULL && maxSize > STREAM_CHUNK_SIZE + 5 * (size_t)width + 22)
+	{
+		maxSize = STREAM_CHUNK_SIZE + 5 * (size_t)width + 22;
+	}
+	if (outputImage->data == NULL || outputImage->dataCapacity < maxSize)
+	{
+		free(outputImage->data);
+		outputImage->data = malloc(maxSize);
+		outputImage->dataCapacity = maxSize;
+	}
+	state->data = outputImage->data;
+	state->stream = outputImage->stream;
+	state->streamedSize = 0;
+
+	// The decoder starts with every entry of the running array set to (0,0,0,0).
+	// The encoder must start with the same values, otherwise OP_INDEX could reference a pixel the decoder does not have.
+	memset(state->runningArray, 0, sizeof(state->runningArray));
 
 	// Set up the previous pixel with the initial value of (0,0,0,255)
-	struct Pixel prevPixel;
+	state->prevPixel.r = 0x00;
+	state->prevPixel.g = 0x00;
+	state->prevPixel.b = 0x00;
+	state->prevPixel.a = 0xFF;
 
-	prevPixel.r = 0x00;
-	prevPixel.g = 0x00;
-	prevPixel.b = 0x00;
-	prevPixel.a = 0xFF;
+	state->run = 0;
+	state->alphaTransform = ALPHA_KEEP;
 
 	// 14 Byte QOI File Header
 	// QOIF text bytes present on all QOI files.
-	outputImage->data[0] = 'q';
-	outputImage->data[1] = 'o';
-	outputImage->data[2] = 'i';
-	outputImage->data[3] = 'f';
+	state->data[0] = 'q';
+	state->data[1] = 'o';
+	state->data[2] = 'i';
+	state->data[3] = 'f';
 	// 4 Bytes that store the image width
-	writeIntToByteArray(outputImage->data, 4, inputImage->width);
+	writeIntToByteArray(state->data, 4, width);
 	// 4 Bytes that store the image height
-	writeIntToByteArray(outputImage->data, 8, inputImage->height);
-	// The number of channels. (Set at 4 for convenience. Image file size will be the same regardless.)
-	outputImage->data[12] = 0x04;
+	writeIntToByteArray(state->data, 8, height);
+	// The number of channels. This is informative only, the decoded file is the same either way.
+	state->data[12] = channels;
 	// The colorspace of the image. (0x00 = SRGB with Linear Alpha, 0x01 All Channels Linear)
-	outputImage->data[13] = 0x00;
+	state->data[13] = colorspace;
 
 	// The initial data index is set at 14 as 0-13 are filled by the header.
 	// This is used as the pixel index used in the for loop is not bound to the index in the data array.
-	int dataIndex = 14;
+	state->dataIndex = 14;
+}
 
-	unsigned char run = 0;
+// Encodes a single pixel, choosing the smallest operation that can represent it.
+// Declared static inline as it is called once per pixel by every input kernel.
+static inline void encodePixel(struct EncoderState *state, struct Pixel currentPixel)
+{
+	char *data = state->data;
 
-	// Start pixel at 0, run the loop while it is less than the number of pixels in the file (height*width).
-	for (int pixel = 0; pixel < inputImage->height * inputImage->width; pixel++)
+	// If run > 0 and the current pixel is not the same as the previous pixel, write the run.
+	// If All the same then increment run ALSO HANDLE CASE IF RUN > 62
+	if (matchingPixels(&currentPixel, &state->prevPixel))
 	{
-		// Shorthand for the pixel at in the input image at the current index.
-		struct Pixel currentPixel = inputImage->pixels[pixel];
-		// If run > 0 and the current pixel is not the same as the previous pixel, write the run.
-		// If All the same then increment run ALSO HANDLE CASE IF RUN > 62
-		if (matchingPixels(&currentPixel, &prevPixel))
+		if (state->run == 62)
 		{
-			if (run == 62)
-			{
-				// Run is max allowed value.
-				// Only 64 values fit in 6 bits (2 taken by tag)
-				// Values 63 and 64 would result in a byte that is the same as the tag
-				// for OP_RGB and OP_RGBA and therefore cannot be used.
+			// Run is max allowed value.
+			// Only 64 values fit in 6 bits (2 taken by tag)
+			// Values 63 and 64 would result in a byte that is the same as the tag
+			// for OP_RGB and OP_RGBA and therefore cannot be used.
 
-				// Save Run
-				saveRun(outputImage->data, &run, &dataIndex);
-			}
+			// Save Run
+			saveRun(data, &state->run, &state->dataIndex);
+		}
 
-			// Add to the run.
-			// If the run was just saved because run == 62, another run can immediately be started again
-			// without needing to save the pixel another way.
-			run++;
+		// Add to the run.
+		// If the run was just saved because run == 62, another run can immediately be started again
+		// without needing to save the pixel another way.
+		state->run++;
 
-			// Can continue because changing the prev pixel & array do not need to be changed as this pixel is the same
-			// as the last.
-			continue;
-		}
+		// Can return because changing the prev pixel & array do not need to be changed as this pixel is the same
+		// as the last.
+		return;
+	}
 
-		if (run > 0)
-		{
-			// The pixel is not the same as the previous one, however there was an existing run.
-			// Save the run before continuing with the current pixel.
-			saveRun(outputImage->data, &run, &dataIndex);
-		}
+	if (state->run > 0)
+	{
+		// The pixel is not the same as the previous one, however there was an existing run.
+		// Save the run before continuing with the current pixel.
+		saveRun(data, &state->run, &state->dataIndex);
+	}
+
+	size_t dataIndex = state->dataIndex;
+	struct Pixel prevPixel = state->prevPixel;
+
+	// Get the hash of the current pixel.
+	// Used for saving to and reading from the running array.
+	unsigned int QOIHash = getQOIHash(&currentPixel);
 
-		// Get the hash of the current pixel.
-		// Used for saving to and reading from the running array.
-		unsigned int QOIHash = getQOIHash(&currentPixel);
+	// If the pixel value in the array at the index of QOIHash is the same as the current pixel,
+	// the index of the pixel can be saved instead of the pixel value. This only uses one byte.
+	if (matchingPixels(&currentPixel, &state->runningArray[QOIHash]))
+	{
+		// OP_INDEX
+		// Save with the tag of 0b00 and the 6 bit QOIHash
+		data[dataIndex] = 0b00000000 | QOIHash;
+		dataIndex++;
+	}
+	// If the alpha does not match, none of the other operations will work. Skip straight to OP_RGBA
+	// which saves the full pixel value including the alpha.
+	else if (currentPixel.a == prevPixel.a)
+	{
+		// Try OP_DIFF
+		// To save the pixel value in one byte, the r, g and b values must be at most 2 less or 1 greater
+		// that the pixel before (including wrapping).
+		// If they are, 2 bits can be dedicated to each part of the pixel (4 values each) and 2 to the tag.
+		int dr = withinWrappedRange(prevPixel.r, currentPixel.r, 2, 1);
+		int dg = withinWrappedRange(prevPixel.g, currentPixel.g, 2, 1);
+		int db = withinWrappedRange(prevPixel.b, currentPixel.b, 2, 1);
 
-		// If the pixel value in the array at the index of QOIHash is the same as the current pixel,
-		// the index of the pixel can be saved instead of the pixel value. This only uses one byte.
-		if (matchingPixels(&currentPixel, &runningArray[QOIHash]))
+		// Check that none of the values returned a invalid response
+		if (dr != INT_MIN && dg != INT_MIN && db != INT_MIN)
 		{
-			// OP_INDEX
-			// Save with the tag of 0b00 and the 6 bit QOIHash
-			outputImage->data[dataIndex] = 0b00000000 | QOIHash;
+			// OP_DIFF
+			// Save the first 2 bits as the tag, then shift the red to the right as the 3rd and 4th bits,
+			// then shift the green to the right as the 5th and 6th bits, with the blue as the last 2 bits.
+			// The values are offset by 2 so that -2 becomes 0 and 1 becomes 3, fitting all values within 2 bits.
+			data[dataIndex] = 0b01000000 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
 			dataIndex++;
 		}
-		// If the alpha does not match, none of the other operations will work. Skip straight to OP_RGBA
-		// which saves the full pixel value including the alpha.
-		else if (currentPixel.a == prevPixel.a)
+		else
 		{
-			// Try OP_DIFF
-			// To save the pixel value in one byte, the r, g and b values must be at most 2 less or 1 greater
-			// that the pixel before (including wrapping).
-			// If they are, 2 bits can be dedicated to each part of the pixel (4 values each) and 2 to the tag.
-			int dr = withinWrappedRange(prevPixel.r, currentPixel.r, 2, 1);
-			int dg = withinWrappedRange(prevPixel.g, currentPixel.g, 2, 1);
-			int db = withinWrappedRange(prevPixel.b, currentPixel.b, 2, 1);
+			// Try OP_LUMA
+			// OP_LUMA can save a pixel value in 2 bytes if certain criteria are met.
+			// 1.	The difference between the previous pixel's green value and the current pixel
+			//		is at most 32 below and 31 above.
+			// 2.	The difference between the previous and current red and green values is at most 8 below and 7 above
+			//		the difference between the previous and current green value (dg)
+			// Ex.
+			//		dg = 24
+			//		dr = 20 (dr - dg = -4)
+			//		db = 31 (db - dg = 7)
+			dg = withinWrappedRange(prevPixel.g, currentPixel.g, 32, 31);
+			// Max value is prev + (dg + 7)
+			// Min value is prev + (dg - 8)
+			dr = withinWrappedRange(prevPixel.r + dg, currentPixel.r, 8, 7);
+			db = withinWrappedRange(prevPixel.b + dg, currentPixel.b, 8, 7);
 
-			// Check that none of the values returned a invalid response
-			if (dr != INT_MIN && dg != INT_MIN && db != INT_MIN)
+			if (dg != INT_MIN && dr != INT_MIN && db != INT_MIN)
 			{
-				// OP_DIFF
-				// Save the first 2 bits as the tag, then shift the red to the right as the 3rd and 4th bits,
-				// then shift the green to the right as the 5th and 6th bits, with the blue as the last 2 bits.
-				// The values are offset by 2 so that -2 becomes 0 and 1 becomes 3, fitting all values within 2 bits.
-				outputImage->data[dataIndex] = 0b01000000 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
-				dataIndex++;
+				// OP_LUMA
+				// If the OP_LUMA criteria are met, it will be stored in 2 bytes.
+				// 2 bit for the tag (0b10), 6 bits for dg (with an offset of 32)
+				// 4 bits for both dr and dg (both with an offset of 8). The dr bits are
+				// shifted 4 to the left to be saved within the same bit as db.
+				data[dataIndex] = 0b10000000 | (dg + 32);
+				data[dataIndex + 1] = (dr + 8) << 4 | (db + 8);
+				dataIndex += 2;
 			}
+			// No other method could save space, however the alpha value is the same as the previous pixel.
 			else
 			{
-				// Try OP_LUMA
-				// OP_LUMA can save a pixel value in 2 bytes if certain criteria are met.
-				// 1.	The difference between the previous pixel's green value and the current pixel
-				//		is at most 32 below and 31 above.
-				// 2.	The difference between the previous and current red and green values is at most 8 below and 7 above
-				//		the difference between the previous and current green value (dg)
-				// Ex.
-				//		dg = 24
-				//		dr = 20 (dr - dg = -4)
-				//		db = 31 (db - dg = 7)
-				dg = withinWrappedRange(prevPixel.g, currentPixel.g, 32, 31);
-				// Max value is prev + (dg + 7)
-				// Min value is prev + (dg - 8)
-				dr = withinWrappedRange(prevPixel.r + dg, currentPixel.r, 8, 7);
-				db = withinWrappedRange(prevPixel.b + dg, currentPixel.b, 8, 7);
-
-				if (dg != INT_MIN && dr != INT_MIN && db != INT_MIN)
-				{
-					// OP_LUMA
-					// If the OP_LUMA criteria are met, it will be stored in 2 bytes.
-					// 2 bit for the tag (0b10), 6 bits for dg (with an offset of 32)
-					// 4 bits for both dr and dg (both with an offset of 8). The dr bits are
-					// shifted 4 to the left to be saved within the same bit as db.
-					outputImage->data[dataIndex] = 0b10000000 | (dg + 32);
-					outputImage->data[dataIndex + 1] = (dr + 8) << 4 | (db + 8);
-					dataIndex += 2;
-				}
-				// No other method could save space, however the alpha value is the same as the previous pixel.
-				else
-				{
-					// OP_RGB
-					// Save the full byte tag
-					outputImage->data[dataIndex] = 0xFE;
-					// Save 1 byte per r, g, b value.
-					// This loses space over saving the raw pixel data,
-					// however hopefully it doesn't need to be done many times.
-					outputImage->data[dataIndex + 1] = currentPixel.r;
-					outputImage->data[dataIndex + 2] = currentPixel.g;
-					outputImage->data[dataIndex + 3] = currentPixel.b;
-					dataIndex += 4;
-				}
+				// OP_RGB
+				// Save the full byte tag
+				data[dataIndex] = 0xFE;
+				// Save 1 byte per r, g, b value.
+				// This loses space over saving the raw pixel data,
+				// however hopefully it doesn't need to be done many times.
+				data[dataIndex + 1] = currentPixel.r;
+				data[dataIndex + 2] = currentPixel.g;
+				data[dataIndex + 3] = currentPixel.b;
+				dataIndex += 4;
 			}
 		}
-		// The alpha is different and OP_RUN and OP_INDEX were nor applicable.
+	}
+	// The alpha is different and OP_RUN and OP_INDEX were nor applicable.
+	else
+	{
+		// OP_RGBA
+		// Save the full byte tag
+		data[dataIndex] = 0xFF;
+		// Save one byte per r, g, b, a value
+		// Similarly to OP_RGB, this loses data compared to saving raw pixel data due to the tag.
+		// This shouldn't happen regularly though, as changes in alpha are rare.
+		data[dataIndex + 1] = currentPixel.r;
+		data[dataIndex + 2] = currentPixel.g;
+		data[dataIndex + 3] = currentPixel.b;
+		data[dataIndex + 4] = currentPixel.a;
+		dataIndex += 5;
+	}
+
+	state->dataIndex = dataIndex;
+	// Set the new previous pixel to the current pixel.
+	state->prevPixel = currentPixel;
+	// Save the current pixel at the corresponding index on the running array.
+	state->runningArray[QOIHash] = currentPixel;
+}
+
+// Encodes a single gray pixel (r = g = b = value) without expanding it to RGBA first.
+// As every pixel written by this function is gray, the previous pixel and every entry in the
+// running array are also gray, so only the value and alpha need to be compared.
+static inline void encodeGrayPixel(struct EncoderState *state, unsigned char value, unsigned char alpha)
+{
+	char *data = state->data;
+
+	if (value == state->prevPixel.r && alpha == state->prevPixel.a)
+	{
+		if (state->run == 62)
+		{
+			saveRun(data, &state->run, &state->dataIndex);
+		}
+		state->run++;
+		return;
+	}
+
+	if (state->run > 0)
+	{
+		saveRun(data, &state->run, &state->dataIndex);
+	}
+
+	size_t dataIndex = state->dataIndex;
+
+	// Same hash as getQOIHash with r = g = b (3 + 5 + 7 = 15).
+	unsigned int QOIHash = (value * 15 + alpha * 11) % 64;
+
+	if (value == state->runningArray[QOIHash].r && alpha == state->runningArray[QOIHash].a)
+	{
+		// OP_INDEX
+		data[dataIndex] = 0b00000000 | QOIHash;
+		dataIndex++;
+	}
+	else if (alpha == state->prevPixel.a)
+	{
+		// All three channels change by the same amount, so one wrapped difference decides
+		// between OP_DIFF and OP_LUMA. Casting to a signed char wraps the difference into -128 to 127.
+		int difference = (signed char)(value - state->prevPixel.r);
+
+		if (difference >= -2 && difference <= 1)
+		{
+			// OP_DIFF with the same difference for r, g and b.
+			data[dataIndex] = 0b01000000 | (difference + 2) << 4 | (difference + 2) << 2 | (difference + 2);
+			dataIndex++;
+		}
+		else if (difference >= -32 && difference <= 31)
+		{
+			// OP_LUMA where dr - dg and db - dg are both 0, stored with their offset of 8.
+			data[dataIndex] = 0b10000000 | (difference + 32);
+			data[dataIndex + 1] = 8 << 4 | 8;
+			dataIndex += 2;
+		}
 		else
 		{
-			// OP_RGBA
-			// Save the full byte tag
-			outputImage->data[dataIndex] = 0xFF;
-			// Save one byte per r, g, b, a value
-			// Similarly to OP_RGB, this loses data compared to saving raw pixel data due to the tag.
-			// This shouldn't happen regularly though, as changes in alpha are rare.
-			outputImage->data[dataIndex + 1] = currentPixel.r;
-			outputImage->data[dataIndex + 2] = currentPixel.g;
-			outputImage->data[dataIndex + 3] = currentPixel.b;
-			outputImage->data[dataIndex + 4] = currentPixel.a;
-			dataIndex += 5;
+			// OP_RGB
+			data[dataIndex] = 0xFE;
+			data[dataIndex + 1] = value;
+			data[dataIndex + 2] = value;
+			data[dataIndex + 3] = value;
+			dataIndex += 4;
 		}
+	}
+	else
+	{
+		// OP_RGBA
+		data[dataIndex] = 0xFF;
+		data[dataIndex + 1] = value;
+		data[dataIndex + 2] = value;
+		data[dataIndex + 3] = value;
+		data[dataIndex + 4] = alpha;
+		dataIndex += 5;
+	}
+
+	state->dataIndex = dataIndex;
+	state->prevPixel.r = value;
+	state->prevPixel.g = value;
+	state->prevPixel.b = value;
+	state->prevPixel.a = alpha;
+	state->runningArray[QOIHash] = state->prevPixel;
+}
 
-		// Set the new previous pixel to the current pixel.
-		prevPixel = currentPixel;
-		// Save the current pixel at the corresponding index on the running array.
-		runningArray[QOIHash] = currentPixel;
+// Writes the waiting data to the output stream once a full chunk has built up.
+// Called by the input kernels at the end of each row. Does nothing if the output isn't streamed.
+static inline void flushQOI(struct EncoderState *state)
+{
+	if (state->stream != NULL && state->dataIndex >= STREAM_CHUNK_SIZE)
+	{
+		fwrite(state->data, 1, state->dataIndex, state->stream);
+		state->streamedSize += state->dataIndex;
+		state->dataIndex = 0;
 	}
+}
+
+// Writes any run that is still open and the QOI footer, then sets the size of the output.
+void finishQOI(struct EncoderState *state, struct OutputImage *outputImage)
+{
 	// If the image ends on a run, the run must be added to the end of the file.
-	if (run > 0)
+	if (state->run > 0)
 	{
 		// Save Run
-		saveRun(outputImage->data, &run, &dataIndex);
+		saveRun(state->data, &state->run, &state->dataIndex);
 	}
 
 	// 8 Byte footer for all QOI files. (7 0x00s followed by a 0x01)
 	for (int i = 0; i < 7; i++)
 	{
-		outputImage->data[dataIndex] = 0x00;
-		dataIndex++;
+		state->data[state->dataIndex] = 0x00;
+		state->dataIndex++;
+	}
+	state->data[state->dataIndex] = 0x01;
+	state->dataIndex++;
+
+	// The rest of a streamed image is written now, so the stream holds the whole file.
+	if (state->stream != NULL)
+	{
+		fwrite(state->data, 1, state->dataIndex, state->stream);
+		fflush(state->stream);
+		state->streamedSize += state->dataIndex;
+		state->dataIndex = 0;
 	}
-	outputImage->data[dataIndex] = 0x01;
-	dataIndex++;
 
 	// Set the dataSize of the output image.
-	outputImage->dataSize = dataIndex;
+	outputImage->dataSize = state->streamedSize + state->dataIndex;
 }
 
-void importImage(char *fileLocation, struct InputImage *inputImage)
+// Applies an alpha transform to one color sample. Fully transparent pixels become black with every transform.
+// Premultiplying rounds value * alpha / 255 to the closest value, which (x + x / 256) / 256 does exactly for x =
+// value * alpha + 128. Unpremultiplying rounds value * 255 / alpha, which is more than 255 for colors brighter than
+// their alpha can hold, so it's clamped.
+static inline unsigned char transformSample(enum AlphaTransform transform, unsigned char value, unsigned char alpha)
 {
-	// Predefine the values to be set by the stb_image import (https://github.com/nothings/stb).
-	int x, y, n;
+	if (transform == ALPHA_KEEP)
+	{
+		return value;
+	}
+	if (alpha == 0)
+	{
+		return 0;
+	}
+	if (transform == ALPHA_PREMULTIPLY)
+	{
+		int product = value * alpha + 128;
+		return (product + (product >> 8)) >> 8;
+	}
+	if (transform == ALPHA_UNPREMULTIPLY)
+	{
+		int quotient = (value * 255 + alpha / 2) / alpha;
+		return quotient > 255 ? 255 : quotient;
+	}
+	return value;
+}
 
-	int channels = 4;
+// Applies an alpha transform to RGBA pixels. The output can be the same as the pixels.
+void transformAlpha(enum AlphaTransform transform, struct Pixel *pixels, int count, struct Pixel *output)
+{
+	int i = 0;
 
-	// Use the stb_image library (https://github.com/nothings/stb) to load images of many types.
-	// Returns a one dimensional array of pixel values.
-	// Each pixel is 4 values in the array (r,g,b,a) and the array length is pixels * 4.
-	unsigned char *data = stbi_load(fileLocation, &x, &y, &n, channels);
+#ifdef __SSE2__
+	// 4 pixels are transformed at a time, with the same result as the plain C version.
+	__m128i zero = _mm_setzero_si128();
+	__m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 maxValue = _mm_set1_ps(255.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i value = _mm_loadu_si128((__m128i *)(pixels + i));
+		__m128i alpha = _mm_and_si128(value, alphaMask);
+		__m128i transparent = _mm_cmpeq_epi32(alpha, zero);
 
-	// String for file location has to be preallocated.
-	inputImage->fileLocation = malloc(sizeof(char) * 261);
-	strcpy(inputImage->fileLocation, fileLocation);
+		if (transform == ALPHA_PREMULTIPLY)
+		{
+			// Each sample is multiplied by the alpha of its pixel as 16 bit values, which the alpha is spread across
+			// by repeating the fourth value of each pixel.
+			__m128i low = _mm_unpacklo_epi8(value, zero);
+			__m128i high = _mm_unpackhi_epi8(value, zero);
+			__m128i lowAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(low, 0xFF), 0xFF);
+			__m128i highAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(high, 0xFF), 0xFF);
+			__m128i bias = _mm_set1_epi16(128);
+			low = _mm_add_epi16(_mm_mullo_epi16(low, lowAlpha), bias);
+			high = _mm_add_epi16(_mm_mullo_epi16(high, highAlpha), bias);
+			low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+			high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+			value = _mm_packus_epi16(low, high);
+		}
+		else if (transform == ALPHA_UNPREMULTIPLY)
+		{
+			// Each pixel is divided as 4 floats. value * 255 and alpha are exact, and a quotient is never within the
+			// rounding error of a float from a half, so rounding it gives the same result as the integer division.
+			// Packing clamps the quotients to 255, and the garbage left by dividing by 0 is cleared below.
+			__m128i low = _mm_unpacklo_epi8(value, zero);
+			__m128i high = _mm_unpackhi_epi8(value, zero);
+			__m128i samples[4] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero), _mm_unpacklo_epi16(high, zero),
+								  _mm_unpackhi_epi16(high, zero)};
+			for (int k = 0; k < 4; k++)
+			{
+				__m128 sample = _mm_cvtepi32_ps(samples[k]);
+				__m128 quotient = _mm_div_ps(_mm_mul_ps(sample, maxValue), _mm_shuffle_ps(sample, sample, 0xFF));
+				samples[k] = _mm_cvttps_epi32(_mm_add_ps(quotient, half));
+			}
+			value = _mm_packus_epi16(_mm_packs_epi32(samples[0], samples[1]), _mm_packs_epi32(samples[2], samples[3]));
+		}
 
-	inputImage->width = x;
-	inputImage->height = y;
-	// Preallocate the size of all the pixels to the array.
-	inputImage->pixels = malloc(sizeof(struct Pixel) * x * y);
+		// The alpha itself is never changed, and fully transparent pixels become 0.
+		value = _mm_or_si128(_mm_andnot_si128(alphaMask, value), alpha);
+		_mm_storeu_si128((__m128i *)(output + i), _mm_andnot_si128(transparent, value));
+	}
+#endif
 
-	// For each pixel, save each channel
-	for (int i = 0; i < x * y; i++)
+	// Plain C version of the same calculation, used for the end of the row.
+	for (; i < count; i++)
 	{
-		// i * channels because each pixel takes up that number of array slots.
-		inputImage->pixels[i].r = data[i * channels + 0];
-		inputImage->pixels[i].g = data[i * channels + 1];
-		inputImage->pixels[i].b = data[i * channels + 2];
-		inputImage->pixels[i].a = data[i * channels + 3];
+		struct Pixel pixel = pixels[i];
+		pixel.r = transformSample(transform, pixel.r, pixel.a);
+		pixel.g = transformSample(transform, pixel.g, pixel.a);
+		pixel.b = transformSample(transform, pixel.b, pixel.a);
+		output[i] = pixel;
 	}
-
-	// Free up image memory.
-	stbi_image_free(data);
 }
 
-void exportQOI(char *fileLocation, struct OutputImage *outputImage)
-{
-	// Open file in writing, binary mode.
-	FILE *f = fopen(fileLocation, "wb");
-
-	// Write all the data stored in the output image.
-	// Provide that there are data size * size of char bytes to write.
-	fwrite(outputImage->data, sizeof(char), outputImage->dataSize, f);
-
-	fclose(f);
-}
+// The number of pixels transformed at a time while encoding, which is small enough to stay in the L1 cache.
+#define ALPHA_CHUNK_SIZE 64
 
-char *getLocation(bool import)
+// Encodes a row of RGBA pixels. The alpha transform of the encoder is applied a small chunk of pixels at a time
+// as they are encoded, so the image is never changed or copied for it.
+void encodePixelRow(struct EncoderState *state, struct Pixel *pixels, int width)
 {
-	// Loop until information that is required has been provided.
-	while (true)
+	if (state->alphaTransform == ALPHA_KEEP)
 	{
-		// Preallocate the space for the response.
-		char *location = malloc(sizeof(char) * 261);
-
-		// Different messages based on the required file.
-		if (import)
+		for (int x = 0; x < width; x++)
 		{
-			printf("Please enter the location of the file you would like to convert:\n");
+			encodePixel(state, pixels[x]);
 		}
-		else
+		return;
+	}
+
+	struct Pixel chunk[ALPHA_CHUNK_SIZE];
+	for (int x = 0; x < width; x += ALPHA_CHUNK_SIZE)
+	{
+		int count = width - x < ALPHA_CHUNK_SIZE ? width - x : ALPHA_CHUNK_SIZE;
+		transformAlpha(state->alphaTransform, pixels + x, count, chunk);
+		for (int i = 0; i < count; i++)
 		{
-			printf("Please enter the location you wish to save as:\n");
+			encodePixel(state, chunk[i]);
 		}
-		// Get the string from the user and copy it to the memory allocated to location.
-		scanf("%s", location);
+	}
+}
 
-		// If an import file is being gathered, check it exists.
-		// Allow through if not import file.
-		if (access(location, F_OK) != -1 || !import)
+// Encodes a row of 8 bit samples with the given number of channels (1 to 4).
+// Gray samples use the gray kernel, RGBA samples are already pixels, and otherwise each pixel is built from the
+// samples as it is encoded. Images without alpha are opaque, so only gray and alpha and RGBA rows are transformed.
+void encodeSampleRow(struct EncoderState *state, unsigned char *samples, int channels, int width)
+{
+	if (channels == 1)
+	{
+		for (int i = 0; i < width; i++)
 		{
-			// Print the result text and return the location.
-			if (import)
-			{
-				printf("Imported");
-			}
-			else
-			{
-				printf("Exported");
-			}
-			printf(" file\n");
-			waitForInput();
-			return location;
+			encodeGrayPixel(state, samples[i], 0xFF);
 		}
-		else
+	}
+	else if (channels == 2)
+	{
+		for (int i = 0; i < width; i++)
 		{
-			// File not found, restart the loop.
-			printf("File not found. Try Again\n");
-			waitForInput();
+			unsigned char alpha = samples[i * 2 + 1];
+			encodeGrayPixel(state, transformSample(state->alphaTransform, samples[i * 2], alpha), alpha);
+		}
+	}
+	else if (channels == 4)
+	{
+		encodePixelRow(state, (struct Pixel *)samples, width);
+	}
+	else
+	{
+		for (int i = 0; i < width; i++)
+		{
+			struct Pixel currentPixel;
+			currentPixel.r = samples[i * channels + 0];
+			currentPixel.g = samples[i * channels + 1];
+			currentPixel.b = samples[i * channels + 2];
+			// Images without an alpha channel are fully opaque.
+			currentPixel.a = 0xFF;
+			encodePixel(state, currentPixel);
 		}
 	}
 }
 
-// Reads the provided args and returns a code based on result.
-// -1 = Source File Does Not Exist
-// 0 = Incorrect Format
-// 1 = Success
-int readArgs(int argc, char *argv[], char *importLocation, char *exportLocation)
+// Encodes an image that has 1 (gray) or 2 (gray, alpha) channels per pixel directly from the
+// samples loaded by stb_image, avoiding a copy of the image that is 4 times larger.
+void convertGrayToQOI(struct InputImage *inputImage, struct OutputImage *outputImage, struct Options *options)
 {
-	// Should be 5 args for a correctly formatted request.
-	// exec, tag 1, path, tag 2, path
-	if (argc != 5)
+	struct EncoderState state;
+	// Gray + alpha is saved as RGBA, gray alone has no alpha so is saved as RGB.
+	startQOI(&state, outputImage, inputImage->width, inputImage->height, inputImage->channels == 2 ? 4 : 3, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	// Each row is encoded straight from the samples, so a streamed output can be flushed between rows.
+	int rowLength = inputImage->width * inputImage->channels;
+	for (unsigned int y = 0; y < inputImage->height; y++)
 	{
-		// Not enough args.
-		return 0;
+		encodeSampleRow(&state, inputImage->samples + (size_t)y * rowLength, inputImage->channels, inputImage->width);
+		flushQOI(&state);
 	}
-	else
+
+	finishQOI(&state, outputImage);
+}
+
+// Reduces a row of 16 bit samples to 8 bits.
+// Each sample is scaled by 255 / 65535 and the matching threshold (0 to 255) is added to the
+// fractional part before it is dropped. A threshold of 0 truncates, 128 rounds and a varying threshold dithers.
+void convert16BitRow(unsigned short *samples, unsigned short *thresholds, unsigned char *output, int count)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	// 8 samples are converted at a time.
+	for (; i + 8 <= count; i += 8)
 	{
-		// Arg 0 is executable.
-		// Arg 1 & 3 should be the parameter tags
-		// Arg 2 & 4 should be the file paths.
+		__m128i value = _mm_loadu_si128((__m128i *)(samples + i));
+		__m128i threshold = _mm_loadu_si128((__m128i *)(thresholds + i));
+		// Saturating add so that values close to 65535 can't wrap around to 0.
+		value = _mm_adds_epu16(value, threshold);
+		// value - value / 256 is value * 255 / 256, which scales 0 to 65535 into 8.8 fixed point 0 to 255.
+		value = _mm_sub_epi16(value, _mm_srli_epi16(value, 8));
+		value = _mm_srli_epi16(value, 8);
+		// Every value is now at most 255, so packing into bytes does not saturate.
+		_mm_storel_epi64((__m128i *)(output + i), _mm_packus_epi16(value, value));
+	}
+#endif
 
-		if ((strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "--source") == 0) && (strcmp(argv[3], "-d") == 0 || strcmp(argv[3], "--destination") == 0))
-		{
-			// Arg 2 is source path.
-			// Arg 4 is destination path.
-			strcpy(importLocation, argv[2]);
-			strcpy(exportLocation, argv[4]);
-		}
-		else if ((strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "--destination") == 0) && (strcmp(argv[3], "-s") == 0 || strcmp(argv[3], "--source") == 0))
+	// Plain C version of the same calculation, used for the end of the row.
+	for (; i < count; i++)
+	{
+		unsigned int value = samples[i] + thresholds[i];
+		if (value > 0xFFFF)
 		{
-			// Arg 2 is destination path.
-			// Arg 4 is source path.
-			strcpy(exportLocation, argv[2]);
-			strcpy(importLocation, argv[4]);
+			value = 0xFFFF;
 		}
-		else
+		output[i] = (value - (value >> 8)) >> 8;
+	}
+}
+
+// Creates the thresholds convert16BitRow adds to each sample of a row, for the down conversion in the options.
+// The dither pattern repeats every 4 rows, so 4 rows of thresholds are enough. Row y uses the thresholds at (y % 4) * rowLength.
+unsigned short *create16BitThresholds(int channels, int rowLength, struct Options *options)
+{
+	// 4x4 Bayer matrix. Each value is a different threshold so neighbouring pixels round in different directions.
+	const unsigned char bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+	unsigned short *thresholds = malloc(sizeof(unsigned short) * rowLength * 4);
+	for (int y = 0; y < 4; y++)
+	{
+		for (int i = 0; i < rowLength; i++)
 		{
-			// Incorrect Format.
-			return 0;
+			if (options->downConversion == DOWN_CONVERSION_DITHER)
+			{
+				// Spread the 16 thresholds evenly over 0 to 255.
+				thresholds[y * rowLength + i] = bayer[y][(i / channels) % 4] * 16 + 8;
+			}
+			else
+			{
+				thresholds[y * rowLength + i] = options->downConversion == DOWN_CONVERSION_ROUND ? 128 : 0;
+			}
 		}
-
-		// The access function determines if there is a file at the location.
-		// Check if it returns -1, if it does, return -1 (Error code for missing source)
-		// and if it doesn't, return success.
-		return access(importLocation, F_OK) == -1 ? -1 : 1;
 	}
+	return thresholds;
 }
 
-void startMenu()
+// Encodes a 16 bit image one row at a time. Each row is reduced to 8 bits in a small
+// buffer and encoded immediately, so an 8 bit copy of the whole image is never made.
+void convert16BitToQOI(struct InputImage *inputImage, struct OutputImage *outputImage, struct Options *options)
 {
-	printf("Welcome to Encode QOI.\n");
+	int channels = inputImage->channels;
+	int rowLength = inputImage->width * channels;
 
-	// Preallocate the maximum space for the location string.
-	char *importLocation = malloc(sizeof(char) * 261);
-	// Copy the value of getLocation to the memory allocated previously.
-	strcpy(importLocation, getLocation(true));
+	struct EncoderState state;
+	startQOI(&state, outputImage, inputImage->width, inputImage->height, channels == 2 || channels == 4 ? 4 : 3, 0x00);
+	state.alphaTransform = options->alphaTransform;
 
-	struct InputImage inputImage;
-	// Import the image located at the file location inputted previously.
-	importImage(importLocation, &inputImage);
+	unsigned short *thresholds = create16BitThresholds(channels, rowLength, options);
 
-	// Creates an empty output image to be filled.
-	struct OutputImage outputImage;
-	// Converts the input image into an output image.
-	// Passing both input and output image by reference
-	convertToQOI(&inputImage, &outputImage);
+	unsigned char *row = malloc(rowLength);
 
-	// Free up input image memory.
-	free(inputImage.pixels);
-	free(inputImage.fileLocation);
+	for (unsigned int y = 0; y < inputImage->height; y++)
+	{
+		convert16BitRow(inputImage->samples16 + (size_t)y * rowLength, thresholds + (y % 4) * rowLength, row, rowLength);
+		encodeSampleRow(&state, row, channels, inputImage->width);
+		flushQOI(&state);
+	}
 
-	// Get the intended location for the export.
+	finishQOI(&state, outputImage);
+
+	free(row);
+	free(thresholds);
+}
+
+// The gamma lookup table is indexed by the top bits of a float between 2^-24 and 1.
+// Each power of 2 is split into 256 steps by the top 8 bits of the mantissa, which keeps the
+// error under a quarter of an 8 bit step everywhere, unlike a table indexed by the value itself
+// which loses the darkest values where the gamma curve is steepest.
+#define GAMMA_TABLE_MIN_EXPONENT 24
+#define GAMMA_TABLE_MANTISSA_BITS 8
+#define GAMMA_TABLE_SIZE (GAMMA_TABLE_MIN_EXPONENT << GAMMA_TABLE_MANTISSA_BITS)
+
+// Gets the gamma table index of a value between 0 and 1 from its bits.
+// Values below 2^-24 use index 0, which is 0 after gamma anyway.
+static inline int getGammaTableIndex(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	// The exponent of 2^-24 is 127 - 24 in the float bits.
+	int index = (int)(bits >> (23 - GAMMA_TABLE_MANTISSA_BITS)) - ((127 - GAMMA_TABLE_MIN_EXPONENT) << GAMMA_TABLE_MANTISSA_BITS);
+	return index < 0 ? 0 : index;
+}
+
+// Fills the gamma lookup table with 8 bit values.
+// Each entry is the value in the middle of its range raised to 1 / gamma.
+void createGammaTable(unsigned char *table, float gamma)
+{
+	for (int i = 0; i < GAMMA_TABLE_SIZE; i++)
+	{
+		int exponent = i >> GAMMA_TABLE_MANTISSA_BITS;
+		int mantissa = i & ((1 << GAMMA_TABLE_MANTISSA_BITS) - 1);
+		double value = ldexp(1.0 + (mantissa + 0.5) / (1 << GAMMA_TABLE_MANTISSA_BITS), exponent - GAMMA_TABLE_MIN_EXPONENT);
+		double result = pow(value, 1.0 / gamma) * 255 + 0.5;
+		table[i] = result > 255 ? 255 : (unsigned char)result;
+	}
+}
+
+// Applies the tonemap to a value, returning a value between 0 and 1 (excluding 1, which is returned as the largest float below 1).
+static inline float tonemapValue(float value, enum Tonemap tonemap)
+{
+	if (tonemap == TONEMAP_REINHARD)
+	{
+		value = value / (1.0f + value);
+	}
+	else if (tonemap == TONEMAP_ACES)
+	{
+		value = (value * (2.51f * value + 0.03f)) / (value * (2.43f * value + 0.59f) + 0.14f);
+	}
+
+	// NaN fails both comparisons, so is also treated as 0.
+	if (!(value > 0.0f))
+	{
+		return 0.0f;
+	}
+	// Keep the value below 1 so its exponent stays within the gamma table.
+	return value < 0.99999994f ? value : 0.99999994f;
+}
+
+// Tonemaps a row of high dynamic range samples into 8 bits.
+// Color channels go through the tonemap and gamma table, while alpha is already between 0 and 1 and is only scaled.
+void tonemapRow(float *samples, int channels, int width, enum Tonemap tonemap, unsigned char *gammaTable, unsigned char *output)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	// 3 channel images (every .hdr file) have no alpha, so every sample can be processed 4 at a time.
+	if (channels == 3)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 largest = _mm_set1_ps(0.99999994f);
+		const __m128i indexOffset = _mm_set1_epi32((127 - GAMMA_TABLE_MIN_EXPONENT) << GAMMA_TABLE_MANTISSA_BITS);
+		int count = width * channels;
+		int indices[4];
+
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 value = _mm_loadu_ps(samples + i);
+
+			if (tonemap == TONEMAP_REINHARD)
+			{
+				value = _mm_div_ps(value, _mm_add_ps(one, value));
+			}
+			else if (tonemap == TONEMAP_ACES)
+			{
+				__m128 numerator = _mm_mul_ps(value, _mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+				__m128 denominator = _mm_add_ps(_mm_mul_ps(value, _mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+				value = _mm_div_ps(numerator, denominator);
+			}
+
+			// Clamp between 0 and just below 1. max with 0 first also turns NaN into 0.
+			value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), largest);
+
+			// Same calculation as getGammaTableIndex, for 4 values.
+			__m128i index = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(value), 23 - GAMMA_TABLE_MANTISSA_BITS), indexOffset);
+			// Negative indices are values too small for the table. The comparison creates a mask to set them to 0.
+			index = _mm_andnot_si128(_mm_cmplt_epi32(index, _mm_setzero_si128()), index);
+			_mm_storeu_si128((__m128i *)indices, index);
+
+			output[i + 0] = gammaTable[indices[0]];
+			output[i + 1] = gammaTable[indices[1]];
+			output[i + 2] = gammaTable[indices[2]];
+			output[i + 3] = gammaTable[indices[3]];
+		}
+	}
+#endif
+
+	// Plain C version, used for the end of the row and for images with alpha.
+	for (; i < width * channels; i++)
+	{
+		bool isAlpha = (channels == 2 || channels == 4) && i % channels == channels - 1;
+		if (isAlpha)
+		{
+			float alpha = samples[i] * 255 + 0.5f;
+			output[i] = alpha > 255 ? 255 : (alpha > 0 ? (unsigned char)alpha : 0);
+		}
+		else
+		{
+			output[i] = gammaTable[getGammaTableIndex(tonemapValue(samples[i], tonemap))];
+		}
+	}
+}
+
+// Encodes a high dynamic range image one row at a time, tonemapping each row into a small 8 bit
+// buffer just before it is encoded.
+void convertHDRToQOI(struct InputImage *inputImage, struct OutputImage *outputImage, struct Options *options)
+{
+	int channels = inputImage->channels;
+	int rowLength = inputImage->width * channels;
+
+	struct EncoderState state;
+	startQOI(&state, outputImage, inputImage->width, inputImage->height, channels == 2 || channels == 4 ? 4 : 3, options->linear ? 0x01 : 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	// Linear output skips gamma, which is the same as a gamma of 1.
+	// Otherwise the gamma of 2.2 matches stb_image's own conversion.
+	unsigned char *gammaTable = malloc(GAMMA_TABLE_SIZE);
+	createGammaTable(gammaTable, options->linear ? 1.0f : 2.2f);
+
+	unsigned char *row = malloc(rowLength);
+
+	for (unsigned int y = 0; y < inputImage->height; y++)
+	{
+		tonemapRow(inputImage->samplesHDR + (size_t)y * rowLength, channels, inputImage->width, options->tonemap, gammaTable, row);
+		encodeSampleRow(&state, row, channels, inputImage->width);
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+
+	free(row);
+	free(gammaTable);
+}
+
+// Moves the base of an image to its last row and negates its pitch, so its rows are walked from the bottom up.
+// This flips the image without copying or swapping any rows.
+void flipRows(unsigned char **base, ptrdiff_t *pitch, int height)
+{
+	*base += (height - 1) * *pitch;
+	*pitch = -*pitch;
+}
+
+// Encodes a rectangle of an 8 bit image as its own QOI image, in place, so crops, atlas regions and windows of a
+// framebuffer don't have to be copied out first. Base points to the first pixel of the image and pitch is the number
+// of bytes from the start of one row to the start of the next, which can be more than a row of the rectangle when
+// the image is part of something larger, or negative when the rows are stored bottom up. Channels is the samples
+// per pixel, where 4 is RGBA pixels.
+void convertRegionToQOI(unsigned char *base, ptrdiff_t pitch, int channels, struct Rectangle *rectangle, struct OutputImage *outputImage, struct Options *options)
+{
+	struct EncoderState state;
+	startQOI(&state, outputImage, rectangle->width, rectangle->height, channels == 2 || channels == 4 ? 4 : 3, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	for (int y = 0; y < rectangle->height; y++)
+	{
+		unsigned char *row = base + (rectangle->y + y) * pitch + (ptrdiff_t)rectangle->x * channels;
+		if (channels == 4)
+		{
+			encodePixelRow(&state, (struct Pixel *)row, rectangle->width);
+		}
+		else
+		{
+			encodeSampleRow(&state, row, channels, rectangle->width);
+		}
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+}
+
+// The byte order of pixels in a buffer that is encoded directly, such as a screen capture or a compositor surface.
+struct PixelFormat
+{
+	char *name;
+	// Bytes per pixel, which is 3 or 4.
+	int size;
+	// The byte within a pixel that holds each of red, green, blue and alpha.
+	unsigned char offsets[4];
+	// Set when the pixels have no alpha, or have a padding byte where it would be, so every pixel is opaque.
+	bool opaque;
+};
+
+const struct PixelFormat pixelFormats[] = {
+	{"rgba", 4, {0, 1, 2, 3}, false},
+	{"bgra", 4, {2, 1, 0, 3}, false},
+	{"argb", 4, {1, 2, 3, 0}, false},
+	{"abgr", 4, {3, 2, 1, 0}, false},
+	{"rgbx", 4, {0, 1, 2, 3}, true},
+	{"bgrx", 4, {2, 1, 0, 3}, true},
+	{"xrgb", 4, {1, 2, 3, 0}, true},
+	{"xbgr", 4, {3, 2, 1, 0}, true},
+	{"rgb", 3, {0, 1, 2, 0}, true},
+	{"bgr", 3, {2, 1, 0, 0}, true},
+};
+#define PIXEL_FORMAT_COUNT (sizeof(pixelFormats) / sizeof(pixelFormats[0]))
+
+// Finds a pixel format by its name, or returns NULL if there isn't one with that name.
+const struct PixelFormat *findPixelFormat(char *name)
+{
+	for (size_t i = 0; i < PIXEL_FORMAT_COUNT; i++)
+	{
+		if (strcmp(pixelFormats[i].name, name) == 0)
+		{
+			return &pixelFormats[i];
+		}
+	}
+	return NULL;
+}
+
+// Reorders pixels of any format into RGBA pixels.
+void swizzlePixelsPlain(const struct PixelFormat *format, unsigned char *source, int count, struct Pixel *output)
+{
+	for (int i = 0; i < count; i++)
+	{
+		unsigned char *pixel = source + i * format->size;
+		output[i].r = pixel[format->offsets[0]];
+		output[i].g = pixel[format->offsets[1]];
+		output[i].b = pixel[format->offsets[2]];
+		output[i].a = format->opaque ? 255 : pixel[format->offsets[3]];
+	}
+}
+
+#ifdef AVX2_DISPATCH
+// Reorders 4 pixels at a time with a single byte shuffle. 16 bytes are loaded for each 4 pixels, which for 3 byte
+// pixels is more than the 12 that are used, so those only take the shuffle while the whole load is within the source.
+__attribute__((target("avx2"))) void swizzlePixelsAVX2(const struct PixelFormat *format, unsigned char *source, int count, struct Pixel *output)
+{
+	// Each output byte takes the byte of its pixel at the channel's offset. Opaque pixels take 0 for alpha
+	// (a shuffle index with the top bit set), which is then set to 255.
+	unsigned char indices[16];
+	for (int i = 0; i < 16; i++)
+	{
+		int channel = i % 4;
+		indices[i] = format->opaque && channel == 3 ? 0x80 : (i / 4) * format->size + format->offsets[channel];
+	}
+	__m128i shuffle = _mm_loadu_si128((__m128i *)indices);
+	__m128i alpha = _mm_set1_epi32(format->opaque ? (int)0xFF000000 : 0);
+
+	int i = 0;
+	for (; i + 4 <= count && i * format->size + 16 <= count * format->size; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((__m128i *)(source + i * format->size));
+		pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha);
+		_mm_storeu_si128((__m128i *)(output + i), pixels);
+	}
+	swizzlePixelsPlain(format, source + i * format->size, count - i, output + i);
+}
+#endif
+
+// Reorders pixels of any format into RGBA pixels with the given kernel.
+void swizzlePixels(int kernel, const struct PixelFormat *format, unsigned char *source, int count, struct Pixel *output)
+{
+#ifdef AVX2_DISPATCH
+	if (kernel == KERNEL_AVX2)
+	{
+		swizzlePixelsAVX2(format, source, count, output);
+		return;
+	}
+#endif
+	swizzlePixelsPlain(format, source, count, output);
+}
+
+// The number of pixels reordered at a time while encoding, which is small enough to stay in the L1 cache.
+#define SWIZZLE_CHUNK_SIZE 64
+
+// Encodes a row of pixels in any of the pixel formats. The pixels are reordered a small chunk at a time as they
+// are encoded, so a BGRA or XRGB buffer needs no RGBA copy. The alpha transform of the encoder is applied to each
+// chunk once it's reordered.
+void encodeFormattedRow(struct EncoderState *state, int kernel, const struct PixelFormat *format, unsigned char *row, int width)
+{
+	bool transformed = state->alphaTransform != ALPHA_KEEP && !format->opaque;
+	struct Pixel chunk[SWIZZLE_CHUNK_SIZE];
+	for (int x = 0; x < width; x += SWIZZLE_CHUNK_SIZE)
+	{
+		int count = width - x < SWIZZLE_CHUNK_SIZE ? width - x : SWIZZLE_CHUNK_SIZE;
+		swizzlePixels(kernel, format, row + (ptrdiff_t)x * format->size, count, chunk);
+		if (transformed)
+		{
+			transformAlpha(state->alphaTransform, chunk, count, chunk);
+		}
+		for (int i = 0; i < count; i++)
+		{
+			encodePixel(state, chunk[i]);
+		}
+	}
+}
+
+// Gets the EXIF orientation an image is encoded in, which is 1 (as it's stored) when orientations are ignored.
+int getOrientation(struct InputImage *inputImage, struct Options *options)
+{
+	return options->ignoreOrientation ? 1 : inputImage->orientation;
+}
+
+// Orientations 5 to 8 swap the rows and columns of the stored image, so each row that is encoded is a column of it.
+static inline bool isTransposed(int orientation)
+{
+	return orientation >= 5 && orientation <= 8;
+}
+
+// Gets the size of an image once it's turned by its orientation.
+void getOrientedSize(struct InputImage *inputImage, struct Options *options, int *width, int *height)
+{
+	bool transposed = isTransposed(getOrientation(inputImage, options));
+	*width = transposed ? inputImage->height : inputImage->width;
+	*height = transposed ? inputImage->width : inputImage->height;
+}
+
+// Works out how to walk an image turned by its orientation, and flipped, in samples of the stored image. First is
+// where the first row starts, and the strides step from one pixel of a row to the next and from one row to the next.
+// Each row runs along a stored row or column, forwards or backwards, so an image is never copied to be turned.
+void orientStrides(int orientation, bool flip, int width, int height, int channels, ptrdiff_t *first, ptrdiff_t *columnStride, ptrdiff_t *rowStride)
+{
+	bool transposed = isTransposed(orientation);
+	ptrdiff_t pitch = (ptrdiff_t)width * channels;
+	*columnStride = transposed ? pitch : channels;
+	*rowStride = transposed ? channels : pitch;
+	int columnCount = transposed ? height : width;
+	int rowCount = transposed ? width : height;
+	*first = 0;
+
+	// Orientations 2, 3, 6 and 7 run each row backwards, and 3, 4, 7 and 8 start from the last row. A flip starts
+	// from the other end again.
+	if (orientation == 2 || orientation == 3 || orientation == 6 || orientation == 7)
+	{
+		*first += (columnCount - 1) * *columnStride;
+		*columnStride = -*columnStride;
+	}
+	if ((orientation == 3 || orientation == 4 || orientation == 7 || orientation == 8) != flip)
+	{
+		*first += (rowCount - 1) * *rowStride;
+		*rowStride = -*rowStride;
+	}
+}
+
+// The bytes of a stored row that are read for each row of a band. Rows of a transposed image each take one pixel
+// from every stored row, so a band of rows as tall as a cache line of pixels uses all of every line it reads.
+#define ORIENTATION_BAND_SIZE 64
+
+// Reads the rows of any input image as 8 bit samples, one at a time and in order, the same way each of the
+// conversions above does. Used by stages that work on rows instead of whole images, such as resizing.
+struct SourceRows
+{
+	struct InputImage *inputImage;
+	// The rectangle of the image that is read, which is all of it unless it's cropped.
+	struct Rectangle region;
+	// The samples per pixel of each row. RGBA pixels have 4.
+	int channels;
+	// The samples in a row that is read.
+	int rowLength;
+	// The samples from the start of one row of the whole image to the next, and to the row that is read first.
+	// A flipped image starts at its last row and has a negative stride.
+	ptrdiff_t rowStride;
+	ptrdiff_t firstRow;
+	// The samples from one pixel of a row to the next. This is the samples per pixel unless the image is turned
+	// by its orientation, when rows can run backwards or down the columns of the stored image.
+	ptrdiff_t columnStride;
+	// Rows that aren't stored in order are gathered into a band of rows at a time, which starts at row bandStart.
+	// NULL when the stored rows are used as they are.
+	unsigned char *band;
+	int bandRows;
+	int bandStart;
+	// Where 16 bit and high dynamic range rows are reduced to 8 bits. NULL for 8 bit images, whose rows are used as they are.
+	unsigned char *row;
+	unsigned short *thresholds;
+	unsigned char *gammaTable;
+	enum Tonemap tonemap;
+};
+
+void startSourceRows(struct SourceRows *rows, struct InputImage *inputImage, struct Rectangle *region, struct Options *options)
+{
+	rows->inputImage = inputImage;
+	rows->region = *region;
+	rows->channels = inputImage->pixels != NULL ? 4 : inputImage->channels;
+	rows->rowLength = region->width * rows->channels;
+	orientStrides(getOrientation(inputImage, options), options->flip, inputImage->width, inputImage->height, rows->channels, &rows->firstRow,
+				  &rows->columnStride, &rows->rowStride);
+	rows->band = NULL;
+	rows->bandRows = 0;
+	rows->bandStart = 0;
+	if (rows->columnStride != rows->channels)
+	{
+		rows->bandRows = ORIENTATION_BAND_SIZE / rows->channels < region->height ? ORIENTATION_BAND_SIZE / rows->channels : region->height;
+		rows->band = malloc((size_t)rows->bandRows * rows->rowLength);
+		rows->bandStart = -rows->bandRows;
+	}
+	rows->row = NULL;
+	rows->thresholds = NULL;
+	rows->gammaTable = NULL;
+	rows->tonemap = options->tonemap;
+
+	if (inputImage->samples16 != NULL)
+	{
+		rows->row = malloc(rows->rowLength);
+		rows->thresholds = create16BitThresholds(rows->channels, rows->rowLength, options);
+	}
+	else if (inputImage->samplesHDR != NULL)
+	{
+		rows->row = malloc(rows->rowLength);
+		rows->gammaTable = malloc(GAMMA_TABLE_SIZE);
+		createGammaTable(rows->gammaTable, options->linear ? 1.0f : 2.2f);
+	}
+}
+
+// Gathers the rows of a turned image from row start into the band. Only JPEGs have an orientation, so the image
+// is always 8 bit. A transposed image is gathered a column of the band at a time, which reads a few pixels in a
+// row of the stored image and writes one pixel to each row of the band, so every stored row is read once per band
+// instead of once for every row.
+void gatherSourceBand(struct SourceRows *rows, int start)
+{
+	struct InputImage *inputImage = rows->inputImage;
+	unsigned char *samples = inputImage->pixels != NULL ? (unsigned char *)inputImage->pixels : inputImage->samples;
+	samples += rows->firstRow + (rows->region.y + start) * rows->rowStride + (ptrdiff_t)rows->region.x * rows->columnStride;
+	int count = rows->region.height - start < rows->bandRows ? rows->region.height - start : rows->bandRows;
+	int channels = rows->channels;
+	rows->bandStart = start;
+
+	// Each pixel is one step along the outer loop and one along the inner loop, whichever way round they are walked.
+	bool byColumn = rows->rowStride == channels || rows->rowStride == -channels;
+	int outerCount = byColumn ? rows->region.width : count;
+	int innerCount = byColumn ? count : rows->region.width;
+	ptrdiff_t outerStride = byColumn ? rows->columnStride : rows->rowStride;
+	ptrdiff_t innerStride = byColumn ? rows->rowStride : rows->columnStride;
+	ptrdiff_t outerStep = byColumn ? channels : rows->rowLength;
+	ptrdiff_t innerStep = byColumn ? rows->rowLength : channels;
+	for (int i = 0; i < outerCount; i++)
+	{
+		unsigned char *source = samples + i * outerStride;
+		unsigned char *output = rows->band + i * outerStep;
+		if (channels == 4)
+		{
+			for (int j = 0; j < innerCount; j++)
+			{
+				*(struct Pixel *)(output + j * innerStep) = *(struct Pixel *)(source + j * innerStride);
+			}
+		}
+		else
+		{
+			for (int j = 0; j < innerCount; j++)
+			{
+				for (int c = 0; c < channels; c++)
+				{
+					output[j * innerStep + c] = source[j * innerStride + c];
+				}
+			}
+		}
+	}
+}
+
+// Gets row y of the region as 8 bit samples. The row is only valid until the next row is read.
+unsigned char *readSourceRow(struct SourceRows *rows, int y)
+{
+	if (rows->band != NULL)
+	{
+		if (y < rows->bandStart || y >= rows->bandStart + rows->bandRows)
+		{
+			gatherSourceBand(rows, y);
+		}
+		return rows->band + (size_t)(y - rows->bandStart) * rows->rowLength;
+	}
+
+	struct InputImage *inputImage = rows->inputImage;
+	ptrdiff_t offset = rows->firstRow + (rows->region.y + y) * rows->rowStride + (ptrdiff_t)rows->region.x * rows->channels;
+	if (inputImage->samples16 != NULL)
+	{
+		convert16BitRow(inputImage->samples16 + offset, rows->thresholds + (y % 4) * rows->rowLength, rows->row, rows->rowLength);
+		return rows->row;
+	}
+	if (inputImage->samplesHDR != NULL)
+	{
+		tonemapRow(inputImage->samplesHDR + offset, rows->channels, rows->region.width, rows->tonemap, rows->gammaTable, rows->row);
+		return rows->row;
+	}
+	if (inputImage->pixels != NULL)
+	{
+		return (unsigned char *)inputImage->pixels + offset;
+	}
+	return inputImage->samples + offset;
+}
+
+void freeSourceRows(struct SourceRows *rows)
+{
+	free(rows->band);
+	free(rows->row);
+	free(rows->thresholds);
+	free(rows->gammaTable);
+}
+
+// Gets the rectangle of the image to encode from the crop in the options, cut down to fit within the image.
+// Returns false if the whole image is encoded.
+bool getCropRegion(struct InputImage *inputImage, struct Options *options, struct Rectangle *region)
+{
+	// The crop is taken from the image once it's turned upright.
+	int width;
+	int height;
+	getOrientedSize(inputImage, options, &width, &height);
+	region->x = 0;
+	region->y = 0;
+	region->width = width;
+	region->height = height;
+	if (options->crop.width == 0)
+	{
+		return false;
+	}
+
+	// Conversions refuse a crop that starts outside the image (see cropStartsInImage), but the start is still kept
+	// within the image so it is never read outside of it. A crop that runs past the image is cut down to fit.
+	struct Rectangle *crop = &options->crop;
+	region->x = crop->x < width ? crop->x : width - 1;
+	region->y = crop->y < height ? crop->y : height - 1;
+	region->width = crop->width < width - region->x ? crop->width : width - region->x;
+	region->height = crop->height < height - region->y ? crop->height : height - region->y;
+	return true;
+}
+
+// Returns false if the crop in the options starts outside the image once it's turned upright.
+// Such a crop has none of the image in it, so the conversion is refused instead of encoding some other part of it.
+bool cropStartsInImage(struct InputImage *inputImage, struct Options *options)
+{
+	int width;
+	int height;
+	getOrientedSize(inputImage, options, &width, &height);
+	return options->crop.width == 0 || (options->crop.x < width && options->crop.y < height);
+}
+
+// Works out the size an image (or the region of it that's encoded) is resized to from the options.
+// A side of 0 in the options keeps the aspect ratio, so only one side has to be given. Returns false if it keeps its size.
+bool getResizedSize(int sourceWidth, int sourceHeight, struct Options *options, int *width, int *height)
+{
+	if (options->resizeWidth == 0 && options->resizeHeight == 0)
+	{
+		return false;
+	}
+	*width = options->resizeWidth;
+	*height = options->resizeHeight;
+	if (*width == 0)
+	{
+		*width = (int)((double)sourceWidth * *height / sourceHeight + 0.5);
+	}
+	if (*height == 0)
+	{
+		*height = (int)((double)sourceHeight * *width / sourceWidth + 0.5);
+	}
+	*width = *width < 1 ? 1 : *width;
+	*height = *height < 1 ? 1 : *height;
+	return *width != sourceWidth || *height != sourceHeight;
+}
+
+// Which source samples make up each output sample along one side of a resized image.
+struct ResizeAxis
+{
+	// The first source sample and number of source samples used for each output sample.
+	int *starts;
+	int *counts;
+	// The weight of each of those source samples, maxCount for each output sample, as 2.14 fixed point adding up to 1.
+	short *weights;
+	int maxCount;
+};
+
+// Works out the source samples and weights of each output sample for the filter.
+// A box filter averages all of the source samples the output sample covers, weighted by how much of each it covers.
+// A bilinear filter blends the 2 source samples nearest to the centre of the output sample.
+void createResizeAxis(struct ResizeAxis *axis, int sourceSize, int outputSize, enum ResizeFilter filter)
+{
+	double ratio = (double)sourceSize / outputSize;
+	axis->maxCount = filter == RESIZE_BOX ? (int)ceil(ratio) + 1 : 2;
+	axis->starts = malloc(sizeof(int) * outputSize);
+	axis->counts = malloc(sizeof(int) * outputSize);
+	axis->weights = calloc((size_t)outputSize * axis->maxCount, sizeof(short));
+
+	double *weights = malloc(sizeof(double) * axis->maxCount);
+	for (int i = 0; i < outputSize; i++)
+	{
+		int start;
+		int count;
+		if (filter == RESIZE_BOX)
+		{
+			double low = i * ratio;
+			double high = (i + 1) * ratio;
+			start = (int)low;
+			int end = (int)ceil(high);
+			end = end > sourceSize ? sourceSize : end;
+			end = end <= start ? start + 1 : end;
+			count = end - start;
+			for (int j = 0; j < count; j++)
+			{
+				double overlap = fmin(high, start + j + 1) - fmax(low, start + j);
+				weights[j] = overlap > 0 ? overlap / ratio : 0;
+			}
+		}
+		else
+		{
+			double position = fmin(fmax((i + 0.5) * ratio - 0.5, 0), sourceSize - 1);
+			start = (int)position;
+			count = start + 1 < sourceSize ? 2 : 1;
+			weights[0] = 1 - (position - start);
+			weights[1] = position - start;
+		}
+
+		// Each weight is the difference between the rounded running totals before and after it, so the weights add up
+		// to exactly 1 and a flat image stays exactly the same, without the rounding building up in any one weight.
+		short *fixedWeights = axis->weights + (size_t)i * axis->maxCount;
+		double total = 0;
+		int fixedTotal = 0;
+		for (int j = 0; j < count; j++)
+		{
+			total += weights[j];
+			int nextFixedTotal = j == count - 1 ? 16384 : (int)lround(total * 16384);
+			fixedWeights[j] = (short)(nextFixedTotal - fixedTotal);
+			fixedTotal = nextFixedTotal;
+		}
+		axis->starts[i] = start;
+		axis->counts[i] = count;
+	}
+	free(weights);
+}
+
+void freeResizeAxis(struct ResizeAxis *axis)
+{
+	free(axis->starts);
+	free(axis->counts);
+	free(axis->weights);
+}
+
+// Resizes a row of 8 bit samples along its width. The output keeps 6 bits below the 8 bit value (255 * 64 at most),
+// so the vertical pass can still round correctly and its values fit the 16 bit multiplies.
+void resizeRowWidth(unsigned char *source, int channels, struct ResizeAxis *axis, int outputWidth, short *output)
+{
+	int x = 0;
+
+#ifdef __SSE2__
+	// RGBA pixels are resized a pixel at a time, with 2 source pixels interleaved sample by sample so a
+	// single multiply-add applies both of their weights.
+	if (channels == 4)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi32(128);
+		for (; x < outputWidth; x++)
+		{
+			unsigned char *pixel = source + axis->starts[x] * 4;
+			short *weights = axis->weights + (size_t)x * axis->maxCount;
+			int count = axis->counts[x];
+			__m128i sum = _mm_setzero_si128();
+			int i = 0;
+			for (; i + 2 <= count; i += 2)
+			{
+				__m128i pair = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(pixel + i * 4)), zero);
+				pair = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+				__m128i weight = _mm_set1_epi32((unsigned short)weights[i] | (weights[i + 1] << 16));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, weight));
+			}
+			if (i < count)
+			{
+				int value;
+				memcpy(&value, pixel + i * 4, 4);
+				__m128i single = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(single, _mm_set1_epi32((unsigned short)weights[i])));
+			}
+			sum = _mm_srai_epi32(_mm_add_epi32(sum, rounding), 8);
+			_mm_storel_epi64((__m128i *)(output + x * 4), _mm_packs_epi32(sum, sum));
+		}
+	}
+#endif
+
+	// Plain C version, used for other numbers of channels.
+	for (; x < outputWidth; x++)
+	{
+		unsigned char *pixel = source + axis->starts[x] * channels;
+		short *weights = axis->weights + (size_t)x * axis->maxCount;
+		for (int c = 0; c < channels; c++)
+		{
+			int sum = 0;
+			for (int i = 0; i < axis->counts[x]; i++)
+			{
+				sum += weights[i] * pixel[i * channels + c];
+			}
+			output[x * channels + c] = (sum + 128) >> 8;
+		}
+	}
+}
+
+// Blends rows that were resized along their width into a row of 8 bit samples, with a weight for each row.
+void blendResizedRows(short **rows, short *weights, int count, int length, unsigned char *output)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	// 8 samples at a time, with 2 rows interleaved so a single multiply-add applies both of their weights.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rounding = _mm_set1_epi32(1 << 19);
+	for (; i + 8 <= length; i += 8)
+	{
+		__m128i low = _mm_setzero_si128();
+		__m128i high = _mm_setzero_si128();
+		for (int k = 0; k < count; k += 2)
+		{
+			__m128i first = _mm_loadu_si128((__m128i *)(rows[k] + i));
+			__m128i second = k + 1 < count ? _mm_loadu_si128((__m128i *)(rows[k + 1] + i)) : zero;
+			__m128i weight = _mm_set1_epi32((unsigned short)weights[k] | (k + 1 < count ? weights[k + 1] << 16 : 0));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(first, second), weight));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(first, second), weight));
+		}
+		low = _mm_srai_epi32(_mm_add_epi32(low, rounding), 20);
+		high = _mm_srai_epi32(_mm_add_epi32(high, rounding), 20);
+		__m128i samples = _mm_packs_epi32(low, high);
+		_mm_storel_epi64((__m128i *)(output + i), _mm_packus_epi16(samples, samples));
+	}
+#endif
+
+	// Plain C version, used for the end of the row.
+	for (; i < length; i++)
+	{
+		int sum = 0;
+		for (int k = 0; k < count; k++)
+		{
+			sum += weights[k] * rows[k][i];
+		}
+		sum = (sum + (1 << 19)) >> 20;
+		output[i] = sum > 255 ? 255 : (sum < 0 ? 0 : sum);
+	}
+}
+
+// Resizes the rows of an image one output row at a time.
+// Each source row is read once and resized along its width into a ring of rows, which only has to hold the
+// rows one output row is made from. Each output row is then blended from that ring, so a few rows are all
+// the memory a resize needs.
+struct Resizer
+{
+	struct SourceRows *sourceRows;
+	int channels;
+	struct ResizeAxis columns;
+	struct ResizeAxis rows;
+	int width;
+	int rowLength;
+	// Source row y is kept at y % ring size, as the rows of one output row are never further apart than that.
+	short *ring;
+	int ringSize;
+	short **window;
+	// The next source row to be read.
+	int nextRow;
+};
+
+void startResizer(struct Resizer *resizer, struct SourceRows *sourceRows, int width, int height, enum ResizeFilter filter)
+{
+	resizer->sourceRows = sourceRows;
+	resizer->channels = sourceRows->channels;
+	createResizeAxis(&resizer->columns, sourceRows->region.width, width, filter);
+	createResizeAxis(&resizer->rows, sourceRows->region.height, height, filter);
+	resizer->width = width;
+	resizer->rowLength = width * resizer->channels;
+	resizer->ringSize = resizer->rows.maxCount;
+	resizer->ring = malloc(sizeof(short) * resizer->rowLength * resizer->ringSize);
+	resizer->window = malloc(sizeof(short *) * resizer->ringSize);
+	resizer->nextRow = 0;
+}
+
+// Makes output row y into output. Rows have to be made in order.
+void resizeNextRow(struct Resizer *resizer, int y, unsigned char *output)
+{
+	int start = resizer->rows.starts[y];
+	int count = resizer->rows.counts[y];
+	int rowLength = resizer->rowLength;
+	// Rows that no output row uses, which a bilinear filter skips when it reduces a lot, are never read.
+	resizer->nextRow = resizer->nextRow < start ? start : resizer->nextRow;
+	for (; resizer->nextRow < start + count; resizer->nextRow++)
+	{
+		unsigned char *row = readSourceRow(resizer->sourceRows, resizer->nextRow);
+		resizeRowWidth(row, resizer->channels, &resizer->columns, resizer->width, resizer->ring + (size_t)(resizer->nextRow % resizer->ringSize) * rowLength);
+	}
+	for (int k = 0; k < count; k++)
+	{
+		resizer->window[k] = resizer->ring + (size_t)((start + k) % resizer->ringSize) * rowLength;
+	}
+	blendResizedRows(resizer->window, resizer->rows.weights + (size_t)y * resizer->rows.maxCount, count, rowLength, output);
+}
+
+void freeResizer(struct Resizer *resizer)
+{
+	free(resizer->window);
+	free(resizer->ring);
+	freeResizeAxis(&resizer->columns);
+	freeResizeAxis(&resizer->rows);
+}
+
+// Encodes a region of an image resized to the given size, from any kind of input image.
+// Each output row is encoded as soon as it's made, so no resized copy of the image is kept.
+void convertResizedToQOI(struct InputImage *inputImage, struct Rectangle *region, struct OutputImage *outputImage, struct Options *options, int width, int height)
+{
+	struct SourceRows sourceRows;
+	startSourceRows(&sourceRows, inputImage, region, options);
+	int channels = sourceRows.channels;
+
+	// The header matches what the image would have without resizing.
+	struct EncoderState state;
+	unsigned char headerChannels = inputImage->pixels != NULL || channels == 2 || channels == 4 ? 4 : 3;
+	startQOI(&state, outputImage, width, height, headerChannels, inputImage->samplesHDR != NULL && options->linear ? 0x01 : 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	struct Resizer resizer;
+	startResizer(&resizer, &sourceRows, width, height, options->resizeFilter);
+	unsigned char *output = malloc(width * channels);
+
+	for (int y = 0; y < height; y++)
+	{
+		resizeNextRow(&resizer, y, output);
+		encodeSampleRow(&state, output, channels, width);
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+
+	free(output);
+	freeResizer(&resizer);
+	freeSourceRows(&sourceRows);
+}
+
+// Makes an 8 bit copy of a region of an image at a new size, from any kind of input image. Images with 4 channels
+// are kept as RGBA pixels and others as samples, the same as they are imported, so the copy can be converted like any other.
+void resizeImage(struct InputImage *inputImage, struct Rectangle *region, struct InputImage *resizedImage, int width, int height, struct Options *options)
+{
+	struct SourceRows sourceRows;
+	startSourceRows(&sourceRows, inputImage, region, options);
+	int channels = sourceRows.channels;
+
+	unsigned char *samples = malloc((size_t)width * height * channels);
+	struct Resizer resizer;
+	startResizer(&resizer, &sourceRows, width, height, options->resizeFilter);
+	for (int y = 0; y < height; y++)
+	{
+		resizeNextRow(&resizer, y, samples + (size_t)y * width * channels);
+	}
+	freeResizer(&resizer);
+	freeSourceRows(&sourceRows);
+
+	resizedImage->width = width;
+	resizedImage->height = height;
+	resizedImage->fileLocation = NULL;
+	resizedImage->pixels = channels == 4 ? (struct Pixel *)samples : NULL;
+	resizedImage->samples = channels == 4 ? NULL : samples;
+	resizedImage->samples16 = NULL;
+	resizedImage->samplesHDR = NULL;
+	resizedImage->channels = channels;
+	resizedImage->orientation = 1;
+}
+
+// Encodes a region of a JPEG turned upright by its orientation.
+void convertOrientedToQOI(struct InputImage *inputImage, struct Rectangle *region, struct OutputImage *outputImage, struct Options *options)
+{
+	struct SourceRows sourceRows;
+	startSourceRows(&sourceRows, inputImage, region, options);
+	int channels = sourceRows.channels;
+
+	struct EncoderState state;
+	startQOI(&state, outputImage, region->width, region->height, channels == 2 || channels == 4 ? 4 : 3, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	for (int y = 0; y < region->height; y++)
+	{
+		unsigned char *row = readSourceRow(&sourceRows, y);
+		if (channels == 4)
+		{
+			encodePixelRow(&state, (struct Pixel *)row, region->width);
+		}
+		else
+		{
+			encodeSampleRow(&state, row, channels, region->width);
+		}
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+	freeSourceRows(&sourceRows);
+}
+
+void convertToQOI(struct InputImage *inputImage, struct OutputImage *outputImage, struct Options *options)
+{
+	// Resized images are read row by row from any kind of input, so they have their own conversion.
+	struct Rectangle region;
+	bool cropped = getCropRegion(inputImage, options, &region);
+	int resizedWidth;
+	int resizedHeight;
+	if (getResizedSize(region.width, region.height, options, &resizedWidth, &resizedHeight))
+	{
+		convertResizedToQOI(inputImage, &region, outputImage, options, resizedWidth, resizedHeight);
+		return;
+	}
+
+	// Images turned by their orientation are read a band of rows at a time, so no turned copy of the image is made.
+	if (getOrientation(inputImage, options) > 1)
+	{
+		convertOrientedToQOI(inputImage, &region, outputImage, options);
+		return;
+	}
+
+	// Cropped and flipped 8 bit images are encoded in place, with a negative pitch to flip them. Other images are
+	// reduced to 8 bits a row at a time, so they are read the same way a resize reads them, at the same size.
+	if ((cropped || options->flip) && inputImage->samples16 == NULL && inputImage->samplesHDR == NULL)
+	{
+		unsigned char *base = inputImage->pixels != NULL ? (unsigned char *)inputImage->pixels : inputImage->samples;
+		int channels = inputImage->pixels != NULL ? 4 : inputImage->channels;
+		ptrdiff_t pitch = (ptrdiff_t)inputImage->width * channels;
+		if (options->flip)
+		{
+			flipRows(&base, &pitch, inputImage->height);
+		}
+		convertRegionToQOI(base, pitch, channels, &region, outputImage, options);
+		return;
+	}
+	if (cropped || options->flip)
+	{
+		convertResizedToQOI(inputImage, &region, outputImage, options, region.width, region.height);
+		return;
+	}
+
+	// High dynamic range images are tonemapped while they are encoded.
+	if (inputImage->samplesHDR != NULL)
+	{
+		convertHDRToQOI(inputImage, outputImage, options);
+		return;
+	}
+
+	// 16 bit images are reduced to 8 bits while they are encoded.
+	if (inputImage->samples16 != NULL)
+	{
+		convert16BitToQOI(inputImage, outputImage, options);
+		return;
+	}
+
+	// Images with only gray channels are kept in their original form and use their own kernel.
+	if (inputImage->pixels == NULL)
+	{
+		convertGrayToQOI(inputImage, outputImage, options);
+		return;
+	}
+
+	struct EncoderState state;
+	startQOI(&state, outputImage, inputImage->width, inputImage->height, 4, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	// Pixels are encoded a row at a time, so a streamed output can be flushed between rows.
+	for (unsigned int y = 0; y < inputImage->height; y++)
+	{
+		encodePixelRow(&state, inputImage->pixels + (size_t)y * inputImage->width, inputImage->width);
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+}
+
+// The most images encoded together by convertImagesToQOI.
+// Each encoder state adds to the values the loop has to keep in registers, and each image adds its own
+// branch patterns for the processor to predict. Beyond 2 images these cost more than the overlap gains.
+#define INTERLEAVED_IMAGES 2
+
+// Encodes the pixels from start to end of each of the images together, one pixel of each image at a time.
+// Each encodePixel depends on the one before it through the previous pixel and running array, so one image
+// keeps the processor waiting on that chain. The images don't depend on each other, so working through
+// them together lets the processor overlap their chains.
+// Count is always a constant where this is called, so the inner loop is unrolled for each count.
+static inline void encodeInterleavedPixels(struct EncoderState *states, struct Pixel **pixels, int count, size_t start, size_t end)
+{
+	for (size_t i = start; i < end; i++)
+	{
+		for (int image = 0; image < count; image++)
+		{
+			encodePixel(&states[image], pixels[image][i]);
+		}
+	}
+}
+
+// Converts a number of images at once, which is faster than converting them one at a time when they are small.
+// RGBA images are encoded together, up to INTERLEAVED_IMAGES at a time. Other images are converted by convertToQOI.
+void convertImagesToQOI(struct InputImage *inputImages, struct OutputImage *outputImages, int count, struct Options *options)
+{
+	struct EncoderState states[INTERLEAVED_IMAGES];
+	struct Pixel *pixels[INTERLEAVED_IMAGES];
+	struct OutputImage *outputs[INTERLEAVED_IMAGES];
+	size_t pixelCounts[INTERLEAVED_IMAGES];
+
+	int next = 0;
+	while (next < count)
+	{
+		// Start encoding the next images that can be encoded together.
+		// A streamed output has to be flushed between rows, and a resized, cropped, flipped, turned or alpha transformed
+		// image is encoded from its own rows, so they are converted on their own.
+		int interleaved = 0;
+		while (next < count && interleaved < INTERLEAVED_IMAGES)
+		{
+			struct InputImage *inputImage = &inputImages[next];
+			struct OutputImage *outputImage = &outputImages[next];
+			next++;
+			int resizedWidth;
+			int resizedHeight;
+			if (inputImage->pixels == NULL || inputImage->samplesHDR != NULL || inputImage->samples16 != NULL || outputImage->stream != NULL ||
+				options->crop.width != 0 || options->flip || getOrientation(inputImage, options) > 1 || options->alphaTransform != ALPHA_KEEP ||
+				getResizedSize(inputImage->width, inputImage->height, options, &resizedWidth, &resizedHeight))
+			{
+				convertToQOI(inputImage, outputImage, options);
+				continue;
+			}
+
+			startQOI(&states[interleaved], outputImage, inputImage->width, inputImage->height, 4, 0x00);
+			pixels[interleaved] = inputImage->pixels;
+			outputs[interleaved] = outputImage;
+			pixelCounts[interleaved] = (size_t)inputImage->width * inputImage->height;
+			interleaved++;
+		}
+
+		// Encode every image up to the end of the smallest one, finish the images that ended, then carry on with the rest.
+		size_t done = 0;
+		while (interleaved > 0)
+		{
+			size_t end = pixelCounts[0];
+			for (int image = 1; image < interleaved; image++)
+			{
+				if (pixelCounts[image] < end)
+				{
+					end = pixelCounts[image];
+				}
+			}
+
+			// The full and single image counts get their own unrolled loops. Any count between them,
+			// only possible when more than 2 images are interleaved, uses the loop that isn't unrolled.
+			if (interleaved == INTERLEAVED_IMAGES)
+			{
+				encodeInterleavedPixels(states, pixels, INTERLEAVED_IMAGES, done, end);
+			}
+			else if (interleaved == 1)
+			{
+				encodeInterleavedPixels(states, pixels, 1, done, end);
+			}
+			else
+			{
+				encodeInterleavedPixels(states, pixels, interleaved, done, end);
+			}
+			done = end;
+
+			// Finished images are replaced by the last image still being encoded.
+			for (int image = interleaved - 1; image >= 0; image--)
+			{
+				if (pixelCounts[image] == end)
+				{
+					finishQOI(&states[image], outputs[image]);
+					interleaved--;
+					states[image] = states[interleaved];
+					pixels[image] = pixels[interleaved];
+					outputs[image] = outputs[interleaved];
+					pixelCounts[image] = pixelCounts[interleaved];
+				}
+			}
+		}
+	}
+}
+
+// Reads a whole file into memory. Returns NULL if the file can't be read.
+unsigned char *readFile(char *fileLocation, size_t *size)
+{
+	FILE *f = fopen(fileLocation, "rb");
+	if (f == NULL)
+	{
+		return NULL;
+	}
+
+	// Find the size by moving to the end of the file, then move back to the start to read it.
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	unsigned char *data = malloc(*size);
+	if (fread(data, 1, *size, f) != *size)
+	{
+		free(data);
+		data = NULL;
+	}
+
+	fclose(f);
+	return data;
+}
+
+// Reads everything left in a stream, such as stdin, into memory. Streams can't be measured first like files can,
+// so the buffer grows as it fills. Returns NULL if the stream couldn't be read.
+unsigned char *readStream(FILE *stream, size_t *size)
+{
+	size_t capacity = 65536;
+	unsigned char *data = malloc(capacity);
+	*size = 0;
+	while (data != NULL)
+	{
+		*size += fread(data + *size, 1, capacity - *size, stream);
+		if (*size < capacity)
+		{
+			break;
+		}
+		capacity *= 2;
+		unsigned char *grown = realloc(data, capacity);
+		if (grown == NULL)
+		{
+			free(data);
+		}
+		data = grown;
+	}
+
+	if (data != NULL && ferror(stream))
+	{
+		free(data);
+		data = NULL;
+	}
+	return data;
+}
+
+// Where stb_image reads an encoded image from: either a whole file in memory, or a stream such as stdin.
+// Checking the image type reads the start of the file, which then has to be read again by the loader.
+// stb_image can only rewind within its first 128 byte buffer, but checking a paletted PNG reads up to
+// its first image data, so a stream keeps every byte read during the checks and replays them instead.
+struct ImageSource
+{
+	unsigned char *file;
+	size_t size;
+	FILE *stream;
+	// The bytes read from the stream so far, while recording.
+	unsigned char *replay;
+	int replaySize;
+	int replayCapacity;
+	// The next replayed byte to give to stb_image.
+	int replayIndex;
+	bool recording;
+	// JPEGs are decoded at a reduced size that keeps their longer side at least this long. 0 for full size.
+	int targetSize;
+	stbi__context context;
+};
+
+// stb_image callbacks for reading from a stream source.
+int readImageSource(void *user, char *data, int size)
+{
+	struct ImageSource *source = user;
+
+	// Bytes that were already read are given back first.
+	int count = source->replaySize - source->replayIndex;
+	if (count > size)
+	{
+		count = size;
+	}
+	if (count > 0)
+	{
+		memcpy(data, source->replay + source->replayIndex, count);
+		source->replayIndex += count;
+	}
+
+	if (count < size)
+	{
+		int read = fread(data + count, 1, size - count, source->stream);
+		if (source->recording && read > 0)
+		{
+			if (source->replaySize + read > source->replayCapacity)
+			{
+				source->replayCapacity = (source->replaySize + read) * 2;
+				source->replay = realloc(source->replay, source->replayCapacity);
+			}
+			memcpy(source->replay + source->replaySize, data + count, read);
+			source->replaySize += read;
+			source->replayIndex = source->replaySize;
+		}
+		count += read;
+	}
+	return count;
+}
+
+// Pipes can't seek, so skipped bytes are read and thrown away.
+void skipImageSource(void *user, int count)
+{
+	char discard[4096];
+	while (count > 0)
+	{
+		int chunk = count < (int)sizeof(discard) ? count : (int)sizeof(discard);
+		int read = readImageSource(user, discard, chunk);
+		if (read <= 0)
+		{
+			return;
+		}
+		count -= read;
+	}
+}
+
+int isEndOfImageSource(void *user)
+{
+	struct ImageSource *source = user;
+	return source->replayIndex >= source->replaySize && (feof(source->stream) || ferror(source->stream));
+}
+
+// Starts reading the source again from its first byte.
+// Record is false for the final load, after which the stream is never read from the start again.
+void startImageSource(struct ImageSource *source, bool record)
+{
+	if (source->stream == NULL)
+	{
+		stbi__start_mem(&source->context, source->file, source->size);
+		return;
+	}
+
+	static stbi_io_callbacks callbacks = {readImageSource, skipImageSource, isEndOfImageSource};
+	source->replayIndex = 0;
+	source->recording = record;
+	stbi__start_callbacks(&source->context, &callbacks, source);
+}
+
+#ifdef AVX2_DISPATCH
+// AVX2 versions of the kernels stb_image decodes JPEGs with. stb_image only has SSE2 versions, which the AVX2 versions
+// replace through the kernel pointers of its decoder. Each gives exactly the same result as stb_image's own kernels.
+
+// A pair of 16 bit constants repeated in every 32 bit lane, for multiplying pairs of values with _mm256_madd_epi16.
+__attribute__((target("avx2"))) static inline __m256i idctConstantsAVX2(int even, int odd)
+{
+	return _mm256_set1_epi32((int)((unsigned int)odd << 16 | (unsigned short)even));
+}
+
+// A row of 8 values of 32 bits from 16 bit values multiplied by 4096. The values must be in the low 4 values of
+// each half of the register, which is how the first pass holds its rows.
+__attribute__((target("avx2"))) static inline __m256i idctWidenAVX2(__m256i row)
+{
+	return _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), row), 4);
+}
+
+// Adds the bias to a, then shifts a + b and a - b down and packs them back to 16 bits. The low half of the result
+// has columns 0 to 3 of a + b then a - b, and the high half columns 4 to 7.
+__attribute__((target("avx2"))) static inline __m256i idctButterflyAVX2(__m256i a, __m256i b, __m256i bias, int shift)
+{
+	__m128i shiftCount = _mm_cvtsi32_si128(shift);
+	a = _mm256_add_epi32(a, bias);
+	return _mm256_packs_epi32(_mm256_sra_epi32(_mm256_add_epi32(a, b), shiftCount), _mm256_sra_epi32(_mm256_sub_epi32(a, b), shiftCount));
+}
+
+// The rest of a pass once the pairs of rows that are rotated and the sum and difference of rows 0 and 4 are ready,
+// which is the same for both passes. Each pair has the values of its two rows interleaved, columns 0 to 3 in the low half
+// and 4 to 7 in the high half. The result is packed into 4 registers the way idctButterflyAVX2 leaves it,
+// with rows 0 and 7, 1 and 6, 2 and 5, and 3 and 4.
+__attribute__((target("avx2"))) static inline void idctPassAVX2(__m256i pairs26, __m256i pairs73, __m256i pairs51, __m256i pairs1735,
+																   __m256i t0e, __m256i t1e, __m256i bias, int shift, __m256i packed[4])
+{
+	// Even part.
+	__m256i t2e = _mm256_madd_epi16(pairs26, idctConstantsAVX2(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f)));
+	__m256i t3e = _mm256_madd_epi16(pairs26, idctConstantsAVX2(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f)));
+	__m256i x0 = _mm256_add_epi32(t0e, t3e);
+	__m256i x3 = _mm256_sub_epi32(t0e, t3e);
+	__m256i x1 = _mm256_add_epi32(t1e, t2e);
+	__m256i x2 = _mm256_sub_epi32(t1e, t2e);
+
+	// Odd part.
+	__m256i y0o = _mm256_madd_epi16(pairs73, idctConstantsAVX2(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f)));
+	__m256i y2o = _mm256_madd_epi16(pairs73, idctConstantsAVX2(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f)));
+	__m256i y1o = _mm256_madd_epi16(pairs51, idctConstantsAVX2(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f)));
+	__m256i y3o = _mm256_madd_epi16(pairs51, idctConstantsAVX2(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f)));
+	__m256i y4o = _mm256_madd_epi16(pairs1735, idctConstantsAVX2(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f)));
+	__m256i y5o = _mm256_madd_epi16(pairs1735, idctConstantsAVX2(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f)));
+	__m256i x4 = _mm256_add_epi32(y0o, y4o);
+	__m256i x5 = _mm256_add_epi32(y1o, y5o);
+	__m256i x6 = _mm256_add_epi32(y2o, y5o);
+	__m256i x7 = _mm256_add_epi32(y3o, y4o);
+
+	packed[0] = idctButterflyAVX2(x0, x7, bias, shift);
+	packed[1] = idctButterflyAVX2(x1, x6, bias, shift);
+	packed[2] = idctButterflyAVX2(x2, x5, bias, shift);
+	packed[3] = idctButterflyAVX2(x3, x4, bias, shift);
+}
+
+// Transposes the packed rows a pass leaves. Result c has column c of every row in its low half and column c + 4 in
+// its high half, so it holds rows c and c + 4 of the transposed block.
+__attribute__((target("avx2"))) static inline void idctTransposeAVX2(__m256i packed[4], __m256i transposed[4])
+{
+	__m256i rows01 = _mm256_unpacklo_epi16(packed[0], packed[1]);
+	__m256i rows23 = _mm256_unpacklo_epi16(packed[2], packed[3]);
+	__m256i rows45 = _mm256_unpackhi_epi16(packed[3], packed[2]);
+	__m256i rows67 = _mm256_unpackhi_epi16(packed[1], packed[0]);
+	__m256i rows0123Low = _mm256_unpacklo_epi32(rows01, rows23);
+	__m256i rows0123High = _mm256_unpackhi_epi32(rows01, rows23);
+	__m256i rows4567Low = _mm256_unpacklo_epi32(rows45, rows67);
+	__m256i rows4567High = _mm256_unpackhi_epi32(rows45, rows67);
+	transposed[0] = _mm256_unpacklo_epi64(rows0123Low, rows4567Low);
+	transposed[1] = _mm256_unpackhi_epi64(rows0123Low, rows4567Low);
+	transposed[2] = _mm256_unpacklo_epi64(rows0123High, rows4567High);
+	transposed[3] = _mm256_unpackhi_epi64(rows0123High, rows4567High);
+}
+
+// Interleaves the values of the two rows held in the halves of a register, for _mm256_madd_epi16, with columns 0 to 3
+// in the low half and 4 to 7 in the high half. The order is the order of the shuffle.
+__attribute__((target("avx2"))) static inline __m256i idctPairAVX2(__m256i rows, __m256i order)
+{
+	return _mm256_shuffle_epi8(_mm256_permute4x64_epi64(rows, 0xD8), order);
+}
+
+// Replaces stbi__idct_simd. Turns the coefficients of an 8x8 block into samples, written out rows of out stride apart.
+// It's the same calculation as stbi__idct_simd, but rows are 32 bits in one register rather than two, and the
+// transposes work on two rows at once.
+__attribute__((target("avx2"))) void idctBlockAVX2(stbi_uc *out, int outStride, short data[64])
+{
+	// Each row is loaded with columns 4 to 7 again in the high half, so interleaving the low 4 values of each half
+	// gives the pairs for a whole row. The last row stops at the end of the block.
+	__m256i row[8];
+	for (int i = 0; i < 7; i++)
+	{
+		row[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((__m128i *)(data + i * 8))), _mm_loadu_si128((__m128i *)(data + i * 8 + 4)), 1);
+	}
+	row[7] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((__m128i *)(data + 56))), _mm_loadl_epi64((__m128i *)(data + 60)), 1);
+
+	// Columns first, with the same rounding as stbi__idct_block.
+	__m256i packed[4];
+	idctPassAVX2(_mm256_unpacklo_epi16(row[2], row[6]), _mm256_unpacklo_epi16(row[7], row[3]), _mm256_unpacklo_epi16(row[5], row[1]),
+				 _mm256_unpacklo_epi16(_mm256_add_epi16(row[1], row[7]), _mm256_add_epi16(row[3], row[5])),
+				 idctWidenAVX2(_mm256_add_epi16(row[0], row[4])), idctWidenAVX2(_mm256_sub_epi16(row[0], row[4])),
+				 _mm256_set1_epi32(512), 10, packed);
+
+	// Then the rows, which are now held in pairs: rows 0 and 4, 1 and 5, 2 and 6, 3 and 7.
+	__m256i pairs[4];
+	idctTransposeAVX2(packed, pairs);
+	const __m256i lowFirst = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15, 0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+	const __m256i highFirst = _mm256_setr_epi8(8, 9, 0, 1, 10, 11, 2, 3, 12, 13, 4, 5, 14, 15, 6, 7, 8, 9, 0, 1, 10, 11, 2, 3, 12, 13, 4, 5, 14, 15, 6, 7);
+	__m256i swapped04 = _mm256_permute2x128_si256(pairs[0], pairs[0], 0x01);
+	__m256i sum1735 = _mm256_add_epi16(pairs[1], _mm256_permute2x128_si256(pairs[3], pairs[3], 0x01));
+	__m256i t0e = _mm256_slli_epi32(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(_mm256_add_epi16(pairs[0], swapped04))), 12);
+	__m256i t1e = _mm256_slli_epi32(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(_mm256_sub_epi16(pairs[0], swapped04))), 12);
+	// The row bias also adds 128 to every sample.
+	idctPassAVX2(idctPairAVX2(pairs[2], lowFirst), idctPairAVX2(pairs[3], highFirst), idctPairAVX2(pairs[1], highFirst),
+				 idctPairAVX2(sum1735, lowFirst), t0e, t1e, _mm256_set1_epi32(65536 + (128 << 17)), 17, packed);
+
+	// Transpose back and pack to bytes, which leaves rows 0, 1, 4 and 5 in one register and 2, 3, 6 and 7 in the other.
+	idctTransposeAVX2(packed, pairs);
+	__m256i rows0145 = _mm256_packus_epi16(pairs[0], pairs[1]);
+	__m256i rows2367 = _mm256_packus_epi16(pairs[2], pairs[3]);
+	__m128i rows[4] = {_mm256_castsi256_si128(rows0145), _mm256_castsi256_si128(rows2367), _mm256_extracti128_si256(rows0145, 1), _mm256_extracti128_si256(rows2367, 1)};
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storel_epi64((__m128i *)out, rows[i]);
+		out += outStride;
+		_mm_storeh_pd((double *)out, _mm_castsi128_pd(rows[i]));
+		out += outStride;
+	}
+}
+
+// Replaces stbi__resample_row_hv_2_simd. Doubles a row of chroma samples in both directions, 16 samples at a time,
+// weighting the nearer row and sample 3 times as much as the farther ones.
+__attribute__((target("avx2"))) stbi_uc *resampleRowHV2AVX2(stbi_uc *out, stbi_uc *inNear, stbi_uc *inFar, int w, int hs)
+{
+	if (w == 1)
+	{
+		out[0] = out[1] = stbi__div4(3 * inNear[0] + inFar[0] + 2);
+		return out;
+	}
+
+	const __m256i bias = _mm256_set1_epi16(8);
+	int i = 0;
+	// The vertically filtered sample before the current 16.
+	int previous = 3 * inNear[0] + inFar[0];
+	// The last sample of the row needs its own edge handling, so it's never part of the 16.
+	for (; i < ((w - 1) & ~15); i += 16)
+	{
+		// 3 * near + far, as 4 * near + (far - near).
+		__m256i near = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(inNear + i)));
+		__m256i far = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(inFar + i)));
+		__m256i current = _mm256_add_epi16(_mm256_slli_epi16(near, 2), _mm256_sub_epi16(far, near));
+
+		// The same samples moved along by one in each direction, across the two halves of the register,
+		// with the sample before and after the 16 moved in at the ends.
+		__m256i before = _mm256_alignr_epi8(current, _mm256_permute2x128_si256(current, current, 0x08), 14);
+		before = _mm256_insert_epi16(before, previous, 0);
+		__m256i after = _mm256_alignr_epi8(_mm256_permute2x128_si256(current, current, 0x81), current, 2);
+		after = _mm256_insert_epi16(after, 3 * inNear[i + 16] + inFar[i + 16], 15);
+
+		// Even outputs are 3 * current + before and odd outputs 3 * current + after.
+		__m256i scaled = _mm256_add_epi16(_mm256_slli_epi16(current, 2), bias);
+		__m256i even = _mm256_add_epi16(scaled, _mm256_sub_epi16(before, current));
+		__m256i odd = _mm256_add_epi16(scaled, _mm256_sub_epi16(after, current));
+
+		// Interleaving within each half of the register keeps the outputs in order.
+		__m256i low = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+		__m256i high = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+		_mm256_storeu_si256((__m256i *)(out + i * 2), _mm256_packus_epi16(low, high));
+
+		previous = 3 * inNear[i + 15] + inFar[i + 15];
+	}
+
+	// The rest of the row the same way as stb_image.
+	int beforeSample = previous;
+	int currentSample = 3 * inNear[i] + inFar[i];
+	out[i * 2] = stbi__div16(3 * currentSample + beforeSample + 8);
+	for (i++; i < w; i++)
+	{
+		beforeSample = currentSample;
+		currentSample = 3 * inNear[i] + inFar[i];
+		out[i * 2 - 1] = stbi__div16(3 * beforeSample + currentSample + 8);
+		out[i * 2] = stbi__div16(3 * currentSample + beforeSample + 8);
+	}
+	out[w * 2 - 1] = stbi__div4(currentSample + 2);
+
+	(void)hs;
+	return out;
+}
+
+// Replaces stbi__YCbCr_to_RGB_simd. Converts 16 pixels at a time when the output is RGBA, which is how importImage
+// decodes color JPEGs, so the result is already in the layout of struct Pixel.
+__attribute__((target("avx2"))) void convertYCbCrToRGBAVX2(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+{
+	int i = 0;
+	if (step == 4)
+	{
+		// The same 4.12 fixed point constants as stb_image.
+		const __m256i crToRed = _mm256_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+		const __m256i crToGreen = _mm256_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+		const __m256i cbToGreen = _mm256_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+		const __m256i cbToBlue = _mm256_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+		const __m128i signFlip = _mm_set1_epi8(-0x80);
+		const __m256i rounding = _mm256_set1_epi16(8);
+		const __m256i alpha = _mm256_set1_epi16(255);
+
+		for (; i + 16 <= count; i += 16)
+		{
+			// Y is scaled up by 16 and the chroma, less 128, by 256, as stb_image does.
+			__m256i luma = _mm256_add_epi16(_mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(y + i))), 4), rounding);
+			__m256i cr = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_xor_si128(_mm_loadu_si128((__m128i *)(pcr + i)), signFlip)), 8);
+			__m256i cb = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_xor_si128(_mm_loadu_si128((__m128i *)(pcb + i)), signFlip)), 8);
+
+			__m256i red = _mm256_srai_epi16(_mm256_add_epi16(luma, _mm256_mulhi_epi16(crToRed, cr)), 4);
+			__m256i green = _mm256_add_epi16(_mm256_add_epi16(luma, _mm256_mulhi_epi16(cbToGreen, cb)), _mm256_mulhi_epi16(cr, crToGreen));
+			green = _mm256_srai_epi16(green, 4);
+			__m256i blue = _mm256_srai_epi16(_mm256_add_epi16(luma, _mm256_mulhi_epi16(cb, cbToBlue)), 4);
+
+			// Interleave the channels within each half of the register: pixels 0 to 7 end up in the low halves
+			// and 8 to 15 in the high halves.
+			__m256i redBlue = _mm256_packus_epi16(red, blue);
+			__m256i greenAlpha = _mm256_packus_epi16(green, alpha);
+			__m256i low = _mm256_unpacklo_epi8(redBlue, greenAlpha);
+			__m256i high = _mm256_unpackhi_epi8(redBlue, greenAlpha);
+			__m256i pixels0 = _mm256_unpacklo_epi16(low, high);
+			__m256i pixels1 = _mm256_unpackhi_epi16(low, high);
+			_mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(pixels0, pixels1, 0x20));
+			_mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(pixels0, pixels1, 0x31));
+			out += 64;
+		}
+	}
+
+	// stb_image's plain C version gives the same result, so it converts the rest.
+	stbi__YCbCr_to_RGB_row(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
+// Sets the kernels stb_image decodes a JPEG with. stbi__setup_jpeg picks its SSE2 kernels, which are replaced with
+// the AVX2 ones when the kernel is KERNEL_AVX2.
+void setJPEGKernels(stbi__jpeg *jpeg, int kernel)
+{
+	stbi__setup_jpeg(jpeg);
+#ifdef AVX2_DISPATCH
+	if (kernel == KERNEL_AVX2)
+	{
+		jpeg->idct_block_kernel = idctBlockAVX2;
+		jpeg->resample_row_hv_2_kernel = resampleRowHV2AVX2;
+		jpeg->YCbCr_to_RGB_kernel = convertYCbCrToRGBAVX2;
+	}
+#else
+	(void)kernel;
+#endif
+}
+
+// Decodes a JPEG with the given kernels. Color images are decoded straight to RGBA pixels, which is the layout of
+// struct Pixel, so they don't have to be copied into it. Gray images are decoded to 1 channel.
+// Channels is what stb_image would decode (1 or 3).
+unsigned char *decodeJPEG(stbi__context *context, int kernel, int channels, int *width, int *height)
+{
+	stbi__jpeg *jpeg = malloc(sizeof(stbi__jpeg));
+	jpeg->s = context;
+	setJPEGKernels(jpeg, kernel);
+	int n;
+	unsigned char *data = load_jpeg_image(jpeg, width, height, &n, channels == 3 ? 4 : 1);
+	free(jpeg);
+	return data;
+}
+
+// JPEGs can be decoded at 1/2, 1/4 or 1/8 of their size, for when only a small image is wanted.
+// Every coefficient still has to be read, but each block is turned into 4x4, 2x2 or 1x1 samples instead of 8x8,
+// and the planes, upsampling and color conversion are that much smaller too.
+
+// What a reduced size decode needs on top of stb_image's decoder.
+struct ScaledJPEG
+{
+	// 2, 4 or 8.
+	int scale;
+	// The width and height that the blocks of each component are decoded to. Subsampled components are reduced less,
+	// so that at 1/8 size the chroma of a 4:2:0 image is still decoded to 2x2 samples instead of being upsampled from 1.
+	int blockWidth[4];
+	int blockHeight[4];
+	// How much each component is still upsampled by afterwards, instead of stb_image's h_max / h and v_max / v.
+	int upsampleWidth[4];
+	int upsampleHeight[4];
+	// The IDCT of N points for N from 1 to 8, as 4.12 fixed point, for output x and coefficient u.
+	int tables[9][8][8];
+};
+
+// Picks the largest reduction that keeps the longer side of the image at least the target size. Returns 1 for no reduction.
+int chooseJPEGScale(int width, int height, int targetSize)
+{
+	int longerSide = width > height ? width : height;
+	if (targetSize <= 0)
+	{
+		return 1;
+	}
+	for (int scale = 8; scale > 1; scale /= 2)
+	{
+		if ((longerSide + scale - 1) / scale >= targetSize)
+		{
+			return scale;
+		}
+	}
+	return 1;
+}
+
+// Picks how many samples a block of a component is decoded to along one side, for a component that stb_image
+// would upsample by the given factor. It's as many as the reduced image needs, up to the 8 the block has.
+int getScaledBlockSize(int scale, int upsample)
+{
+	int needed = 8 / scale * upsample;
+	for (int size = 8; size > 1; size--)
+	{
+		if (needed % size == 0)
+		{
+			return size;
+		}
+	}
+	return 1;
+}
+
+// Sets up the block sizes of every component once the frame header is read.
+void startScaledJPEG(struct ScaledJPEG *scaled, stbi__jpeg *jpeg, int scale)
+{
+	scaled->scale = scale;
+
+	// The 8 point IDCT is the sum of C(u) / 2 * F(u) * cos((2x + 1)uπ / 16), with C(0) = 1 / √2 and 1 otherwise.
+	// Using the lowest N coefficients with N points instead gives the same image sampled at the centre of every
+	// 8 / N pixels, at the same brightness.
+	for (int size = 1; size <= 8; size++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			for (int u = 0; u < size; u++)
+			{
+				double factor = (u == 0 ? sqrt(0.5) : 1.0) / 2 * cos((2 * x + 1) * u * 3.14159265358979323846 / (2 * size));
+				scaled->tables[size][x][u] = (int)lround(factor * 4096);
+			}
+		}
+	}
+
+	for (int n = 0; n < jpeg->s->img_n; n++)
+	{
+		int upsampleWidth = jpeg->img_h_max / jpeg->img_comp[n].h;
+		int upsampleHeight = jpeg->img_v_max / jpeg->img_comp[n].v;
+		scaled->blockWidth[n] = getScaledBlockSize(scale, upsampleWidth);
+		scaled->blockHeight[n] = getScaledBlockSize(scale, upsampleHeight);
+		scaled->upsampleWidth[n] = 8 / scale * upsampleWidth / scaled->blockWidth[n];
+		scaled->upsampleHeight[n] = 8 / scale * upsampleHeight / scaled->blockHeight[n];
+	}
+}
+
+// Turns the dequantized coefficients of a block of component n into its reduced samples, written rows of out stride apart.
+void idctScaledBlock(stbi__jpeg *jpeg, struct ScaledJPEG *scaled, int n, unsigned char *out, int outStride, short data[64])
+{
+	int width = scaled->blockWidth[n];
+	int height = scaled->blockHeight[n];
+
+	// Components that aren't reduced at all use the normal IDCT.
+	if (width == 8 && height == 8)
+	{
+		jpeg->idct_block_kernel(out, outStride, data);
+		return;
+	}
+
+	// The average of the block is DC / 8.
+	if (width == 1 && height == 1)
+	{
+		out[0] = stbi__clamp((data[0] + 4 + 8 * 128) >> 3);
+		return;
+	}
+
+	// Rows of coefficients first, then columns, each keeping the same scale as the coefficients.
+	int rows[8][8];
+	for (int v = 0; v < height; v++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			int sum = 0;
+			for (int u = 0; u < width; u++)
+			{
+				sum += scaled->tables[width][x][u] * data[v * 8 + u];
+			}
+			rows[v][x] = (sum + 2048) >> 12;
+		}
+	}
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			int sum = 0;
+			for (int v = 0; v < height; v++)
+			{
+				sum += scaled->tables[height][y][v] * rows[v][x];
+			}
+			out[y * outStride + x] = stbi__clamp(((sum + 2048) >> 12) + 128);
+		}
+	}
+}
+
+// Decodes the block of component n at the block position into its reduced plane.
+bool decodeScaledJPEGBlock(stbi__jpeg *jpeg, struct ScaledJPEG *scaled, int n, int blockX, int blockY)
+{
+	STBI_SIMD_ALIGN(short, data[64]);
+	int huffman = jpeg->img_comp[n].ha;
+	if (!stbi__jpeg_decode_block(jpeg, data, jpeg->huff_dc + jpeg->img_comp[n].hd, jpeg->huff_ac + huffman, jpeg->fast_ac[huffman], n, jpeg->dequant[jpeg->img_comp[n].tq]))
+	{
+		return false;
+	}
+	int stride = jpeg->img_comp[n].w2;
+	idctScaledBlock(jpeg, scaled, n, jpeg->img_comp[n].data + stride * blockY * scaled->blockHeight[n] + blockX * scaled->blockWidth[n], stride, data);
+	return true;
+}
+
+// Counts down the restart interval after each MCU, the same as stbi__parse_entropy_coded_data.
+// Returns false if the scan ends early because the restart marker is missing.
+bool continueJPEGScan(stbi__jpeg *jpeg)
+{
+	if (--jpeg->todo <= 0)
+	{
+		if (jpeg->code_bits < 24)
+		{
+			stbi__grow_buffer_unsafe(jpeg);
+		}
+		// Without a restart marker the rest of the image is left as it is rather than failing.
+		if (!STBI__RESTART(jpeg->marker))
+		{
+			return false;
+		}
+		stbi__jpeg_reset(jpeg);
+	}
+	return true;
+}
+
+// Decodes one scan of a baseline JPEG into the reduced planes. Progressive scans only collect coefficients,
+// which stb_image does, and they are turned into samples once every scan is read.
+bool decodeScaledJPEGScan(stbi__jpeg *jpeg, struct ScaledJPEG *scaled)
+{
+	if (jpeg->progressive)
+	{
+		return stbi__parse_entropy_coded_data(jpeg);
+	}
+
+	stbi__jpeg_reset(jpeg);
+
+	// A scan of one component has its blocks in plain row order.
+	if (jpeg->scan_n == 1)
+	{
+		int n = jpeg->order[0];
+		int width = (jpeg->img_comp[n].x + 7) >> 3;
+		int height = (jpeg->img_comp[n].y + 7) >> 3;
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				if (!decodeScaledJPEGBlock(jpeg, scaled, n, i, j))
+				{
+					return false;
+				}
+				if (!continueJPEGScan(jpeg))
+				{
+					return true;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Otherwise each MCU has h x v blocks of every component in turn.
+	for (int j = 0; j < jpeg->img_mcu_y; j++)
+	{
+		for (int i = 0; i < jpeg->img_mcu_x; i++)
+		{
+			for (int k = 0; k < jpeg->scan_n; k++)
+			{
+				int n = jpeg->order[k];
+				for (int y = 0; y < jpeg->img_comp[n].v; y++)
+				{
+					for (int x = 0; x < jpeg->img_comp[n].h; x++)
+					{
+						if (!decodeScaledJPEGBlock(jpeg, scaled, n, i * jpeg->img_comp[n].h + x, j * jpeg->img_comp[n].v + y))
+						{
+							return false;
+						}
+					}
+				}
+			}
+			if (!continueJPEGScan(jpeg))
+			{
+				return true;
+			}
+		}
+	}
+	return true;
+}
+
+// Reads every scan of a JPEG into reduced planes, the same as stbi__decode_jpeg_image does at full size.
+bool decodeScaledJPEGPlanes(stbi__jpeg *jpeg, struct ScaledJPEG *scaled, int scale)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		jpeg->img_comp[i].raw_data = NULL;
+		jpeg->img_comp[i].raw_coeff = NULL;
+	}
+	jpeg->restart_interval = 0;
+	if (!stbi__decode_jpeg_header(jpeg, STBI__SCAN_load))
+	{
+		return false;
+	}
+	startScaledJPEG(scaled, jpeg, scale);
+
+	// stb_image allocates full size planes with the header. They haven't been written to yet, so they're swapped for
+	// reduced ones straight away. Progressive coefficients are still kept at full size.
+	for (int n = 0; n < jpeg->s->img_n; n++)
+	{
+		free(jpeg->img_comp[n].raw_data);
+		jpeg->img_comp[n].w2 = jpeg->img_comp[n].w2 / 8 * scaled->blockWidth[n];
+		jpeg->img_comp[n].h2 = jpeg->img_comp[n].h2 / 8 * scaled->blockHeight[n];
+		jpeg->img_comp[n].raw_data = malloc((size_t)jpeg->img_comp[n].w2 * jpeg->img_comp[n].h2 + 15);
+		if (jpeg->img_comp[n].raw_data == NULL)
+		{
+			return false;
+		}
+		jpeg->img_comp[n].data = (stbi_uc *)(((size_t)jpeg->img_comp[n].raw_data + 15) & ~(size_t)15);
+	}
+
+	int marker = stbi__get_marker(jpeg);
+	while (!stbi__EOI(marker))
+	{
+		if (stbi__SOS(marker))
+		{
+			if (!stbi__process_scan_header(jpeg) || !decodeScaledJPEGScan(jpeg, scaled))
+			{
+				return false;
+			}
+			// Some cameras pad the end of the image data with zeros, which are skipped to find the next marker.
+			if (jpeg->marker == STBI__MARKER_none)
+			{
+				while (!stbi__at_eof(jpeg->s))
+				{
+					if (stbi__get8(jpeg->s) == 255)
+					{
+						jpeg->marker = stbi__get8(jpeg->s);
+						break;
+					}
+				}
+			}
+		}
+		else if (stbi__DNL(marker))
+		{
+			int length = stbi__get16be(jpeg->s);
+			stbi__uint32 height = stbi__get16be(jpeg->s);
+			if (length != 4 || height != jpeg->s->img_y)
+			{
+				return false;
+			}
+		}
+		else if (!stbi__process_marker(jpeg, marker))
+		{
+			return false;
+		}
+		marker = stbi__get_marker(jpeg);
+	}
+
+	// The coefficients of a progressive JPEG are complete once every scan is read.
+	if (jpeg->progressive)
+	{
+		for (int n = 0; n < jpeg->s->img_n; n++)
+		{
+			int width = (jpeg->img_comp[n].x + 7) >> 3;
+			int height = (jpeg->img_comp[n].y + 7) >> 3;
+			int stride = jpeg->img_comp[n].w2;
+			for (int j = 0; j < height; j++)
+			{
+				for (int i = 0; i < width; i++)
+				{
+					short *data = jpeg->img_comp[n].coeff + 64 * (i + j * jpeg->img_comp[n].coeff_w);
+					stbi__jpeg_dequantize(data, jpeg->dequant[jpeg->img_comp[n].tq]);
+					idctScaledBlock(jpeg, scaled, n, jpeg->img_comp[n].data + stride * j * scaled->blockHeight[n] + i * scaled->blockWidth[n], stride, data);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Decodes a JPEG at 1 / scale of its size (rounded up), as RGBA pixels or 1 channel the same as decodeJPEG.
+// The planes are upsampled and converted to color the same way load_jpeg_image does at full size.
+unsigned char *decodeScaledJPEG(stbi__context *context, int kernel, int scale, int channels, int *width, int *height)
+{
+	stbi__jpeg *jpeg = malloc(sizeof(stbi__jpeg));
+	jpeg->s = context;
+	setJPEGKernels(jpeg, kernel);
+	context->img_n = 0;
+
+	struct ScaledJPEG scaled;
+	if (!decodeScaledJPEGPlanes(jpeg, &scaled, scale))
+	{
+		stbi__cleanup_jpeg(jpeg);
+		free(jpeg);
+		return NULL;
+	}
+
+	int outputWidth = (context->img_x + scale - 1) / scale;
+	int outputHeight = (context->img_y + scale - 1) / scale;
+	int outputChannels = channels == 3 ? 4 : 1;
+	int componentCount = context->img_n;
+	bool isRGB = componentCount == 3 && (jpeg->rgb == 3 || (jpeg->app14_color_transform == 0 && !jpeg->jfif));
+
+	// Each component is upsampled to the full width one row at a time, with the same filters as stb_image.
+	stbi__resample resamplers[4];
+	int rowCounts[4];
+	for (int k = 0; k < componentCount; k++)
+	{
+		stbi__resample *resampler = &resamplers[k];
+		jpeg->img_comp[k].linebuf = malloc(outputWidth + 3);
+		resampler->hs = scaled.upsampleWidth[k];
+		resampler->vs = scaled.upsampleHeight[k];
+		resampler->ystep = resampler->vs >> 1;
+		resampler->w_lores = (outputWidth + resampler->hs - 1) / resampler->hs;
+		resampler->ypos = 0;
+		resampler->line0 = resampler->line1 = jpeg->img_comp[k].data;
+		rowCounts[k] = (jpeg->img_comp[k].y * scaled.blockHeight[k] + 7) / 8;
+
+		if (resampler->hs == 1 && resampler->vs == 1)
+		{
+			resampler->resample = resample_row_1;
+		}
+		else if (resampler->hs == 1 && resampler->vs == 2)
+		{
+			resampler->resample = stbi__resample_row_v_2;
+		}
+		else if (resampler->hs == 2 && resampler->vs == 1)
+		{
+			resampler->resample = stbi__resample_row_h_2;
+		}
+		else if (resampler->hs == 2 && resampler->vs == 2)
+		{
+			resampler->resample = jpeg->resample_row_hv_2_kernel;
+		}
+		else
+		{
+			resampler->resample = stbi__resample_row_generic;
+		}
+	}
+
+	unsigned char *output = malloc((size_t)outputWidth * outputHeight * outputChannels);
+	for (int y = 0; y < outputHeight; y++)
+	{
+		unsigned char *out = output + (size_t)outputWidth * outputChannels * y;
+		unsigned char *rows[4];
+		for (int k = 0; k < componentCount; k++)
+		{
+			stbi__resample *resampler = &resamplers[k];
+			bool bottom = resampler->ystep >= (resampler->vs >> 1);
+			rows[k] = resampler->resample(jpeg->img_comp[k].linebuf, bottom ? resampler->line1 : resampler->line0,
+										  bottom ? resampler->line0 : resampler->line1, resampler->w_lores, resampler->hs);
+			if (++resampler->ystep >= resampler->vs)
+			{
+				resampler->ystep = 0;
+				resampler->line0 = resampler->line1;
+				if (++resampler->ypos < rowCounts[k])
+				{
+					resampler->line1 += jpeg->img_comp[k].w2;
+				}
+			}
+		}
+
+		if (outputChannels == 1)
+		{
+			memcpy(out, rows[0], outputWidth);
+		}
+		else if (componentCount == 3 && !isRGB)
+		{
+			jpeg->YCbCr_to_RGB_kernel(out, rows[0], rows[1], rows[2], outputWidth, 4);
+		}
+		else if (componentCount == 4 && jpeg->app14_color_transform != 0)
+		{
+			jpeg->YCbCr_to_RGB_kernel(out, rows[0], rows[1], rows[2], outputWidth, 4);
+			// YCCK is inverted CMY with K, the same as stb_image.
+			if (jpeg->app14_color_transform == 2)
+			{
+				for (int i = 0; i < outputWidth; i++)
+				{
+					for (int c = 0; c < 3; c++)
+					{
+						out[i * 4 + c] = stbi__blinn_8x8(255 - out[i * 4 + c], rows[3][i]);
+					}
+				}
+			}
+		}
+		else
+		{
+			// RGB, or CMYK with the colors multiplied by K.
+			for (int i = 0; i < outputWidth; i++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					out[i * 4 + c] = componentCount == 4 ? stbi__blinn_8x8(rows[c][i], rows[3][i]) : rows[c][i];
+				}
+				out[i * 4 + 3] = 255;
+			}
+		}
+	}
+
+	stbi__cleanup_jpeg(jpeg);
+	free(jpeg);
+	*width = outputWidth;
+	*height = outputHeight;
+	return output;
+}
+
+// Reads a 16 or 32 bit value from an EXIF block in the byte order of the block.
+static inline unsigned int readExifValue(unsigned char *bytes, int size, bool bigEndian)
+{
+	unsigned int value = 0;
+	for (int i = 0; i < size; i++)
+	{
+		value |= (unsigned int)bytes[bigEndian ? i : size - 1 - i] << (8 * (size - 1 - i));
+	}
+	return value;
+}
+
+// Finds the orientation tag in the first directory of an EXIF block, which is a TIFF header after "Exif\0\0".
+// Returns 1 if there isn't a valid one.
+int readExifOrientation(unsigned char *exif, int size)
+{
+	if (size < 14 || memcmp(exif, "Exif\0\0", 6) != 0)
+	{
+		return 1;
+	}
+	unsigned char *tiff = exif + 6;
+	size -= 6;
+	bool bigEndian = tiff[0] == 'M' && tiff[1] == 'M';
+	if ((!bigEndian && (tiff[0] != 'I' || tiff[1] != 'I')) || readExifValue(tiff + 2, 2, bigEndian) != 42)
+	{
+		return 1;
+	}
+
+	unsigned int directory = readExifValue(tiff + 4, 4, bigEndian);
+	if (directory > (unsigned int)size - 2)
+	{
+		return 1;
+	}
+	int entryCount = readExifValue(tiff + directory, 2, bigEndian);
+	for (int i = 0; i < entryCount; i++)
+	{
+		// Each entry is a tag, a type, a count and a value, which is a short for the orientation.
+		unsigned int entry = directory + 2 + i * 12;
+		if (entry + 12 > (unsigned int)size)
+		{
+			break;
+		}
+		if (readExifValue(tiff + entry, 2, bigEndian) == 0x0112)
+		{
+			int orientation = readExifValue(tiff + entry + 8, 2, bigEndian);
+			return orientation >= 1 && orientation <= 8 ? orientation : 1;
+		}
+	}
+	return 1;
+}
+
+// Reads the EXIF orientation of a JPEG from its APP1 segment, which comes before the frame.
+// Returns 1 if it doesn't have one.
+int readJPEGOrientation(stbi__context *context)
+{
+	if (stbi__get8(context) != 0xFF || stbi__get8(context) != 0xD8)
+	{
+		return 1;
+	}
+
+	while (!stbi__at_eof(context))
+	{
+		if (stbi__get8(context) != 0xFF)
+		{
+			return 1;
+		}
+		int marker = stbi__get8(context);
+		while (marker == 0xFF)
+		{
+			marker = stbi__get8(context);
+		}
+
+		// Markers without a segment.
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+		{
+			continue;
+		}
+		// The EXIF block comes before the frame, so reaching the frame or the scan means there isn't one.
+		if ((marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) || marker == 0xDA || marker == 0xD9)
+		{
+			return 1;
+		}
+
+		int length = stbi__get16be(context) - 2;
+		if (length < 0)
+		{
+			return 1;
+		}
+		// A JPEG can have other APP1 segments, such as XMP, before or after its EXIF block.
+		if (marker == 0xE1 && length >= 6)
+		{
+			unsigned char *segment = malloc(length);
+			bool read = stbi__getn(context, segment, length);
+			bool exif = read && memcmp(segment, "Exif\0\0", 6) == 0;
+			int orientation = exif ? readExifOrientation(segment, length) : 1;
+			free(segment);
+			if (exif || !read)
+			{
+				return orientation;
+			}
+			continue;
+		}
+		stbi__skip(context, length);
+	}
+	return 1;
+}
+
+// Decodes an image from a source. stb_image is compiled into this file, so its internal
+// format checks and loaders can read from the same source instead of opening it again each time.
+// Returns false if stb_image can't decode it.
+bool importImageFromSource(struct ImageSource *source, struct InputImage *inputImage)
+{
+	// Predefine the values to be set by the stb_image import (https://github.com/nothings/stb).
+	int x, y, n;
+
+	inputImage->fileLocation = NULL;
+	inputImage->samples16 = NULL;
+	inputImage->samplesHDR = NULL;
+	inputImage->orientation = 1;
+
+	// High dynamic range images are loaded as floats. Loading them with stbi_load would make
+	// stb_image convert them with pow for every sample before they reach the encoder.
+	// Each format test reads the start of the file, and the source is started again after it.
+	startImageSource(source, true);
+	if (stbi__hdr_test(&source->context))
+	{
+		startImageSource(source, false);
+		inputImage->samplesHDR = stbi__loadf_main(&source->context, &x, &y, &n, 0);
+		inputImage->width = x;
+		inputImage->height = y;
+		inputImage->channels = n;
+		inputImage->samples = NULL;
+		inputImage->pixels = NULL;
+		return inputImage->samplesHDR != NULL;
+	}
+
+	// 16 bit images (PNG and PSD) are loaded at their full precision. Loading them with stbi_load would
+	// make stb_image reduce them to 8 bits in an extra pass over the whole image.
+	startImageSource(source, true);
+	if (stbi__is_16_main(&source->context))
+	{
+		startImageSource(source, false);
+		inputImage->samples16 = stbi__load_and_postprocess_16bit(&source->context, &x, &y, &n, 0);
+		inputImage->width = x;
+		inputImage->height = y;
+		inputImage->channels = n;
+		inputImage->samples = NULL;
+		inputImage->pixels = NULL;
+		return inputImage->samples16 != NULL;
+	}
+
+	// JPEGs are decoded with the best kernels the processor supports, and color ones straight to pixels.
+	int jpegChannels;
+	startImageSource(source, true);
+	if (stbi__jpeg_info(&source->context, &x, &y, &jpegChannels))
+	{
+		// stb_image skips the EXIF block, so its orientation is read first. The info already read past it, so a
+		// stream replays it from what was recorded.
+		startImageSource(source, true);
+		inputImage->orientation = readJPEGOrientation(&source->context);
+		startImageSource(source, false);
+		int scale = chooseJPEGScale(x, y, source->targetSize);
+		unsigned char *data = scale == 1 ? decodeJPEG(&source->context, getBestKernel(), jpegChannels, &x, &y)
+										 : decodeScaledJPEG(&source->context, getBestKernel(), scale, jpegChannels, &x, &y);
+		inputImage->width = x;
+		inputImage->height = y;
+		inputImage->channels = jpegChannels;
+		inputImage->samples = jpegChannels == 1 ? data : NULL;
+		inputImage->pixels = jpegChannels == 1 ? NULL : (struct Pixel *)data;
+		return data != NULL;
+	}
+
+	// Use the stb_image library (https://github.com/nothings/stb) to load images of many types.
+	// Returns a one dimensional array of pixel values.
+	// Requesting 0 channels keeps the number of channels in the file (n), so the array length is pixels * n.
+	startImageSource(source, false);
+	unsigned char *data = stbi__load_and_postprocess_8bit(&source->context, &x, &y, &n, 0);
+	if (data == NULL)
+	{
+		inputImage->samples = NULL;
+		inputImage->pixels = NULL;
+		return false;
+	}
+
+	inputImage->width = x;
+	inputImage->height = y;
+	inputImage->channels = n;
+
+	// Gray images are encoded straight from the loaded samples.
+	if (n <= 2)
+	{
+		inputImage->samples = data;
+		inputImage->pixels = NULL;
+		return true;
+	}
+
+	inputImage->samples = NULL;
+	// Preallocate the size of all the pixels to the array.
+	inputImage->pixels = malloc(sizeof(struct Pixel) * x * y);
+
+	// For each pixel, save each channel
+	for (size_t i = 0; i < (size_t)x * y; i++)
+	{
+		// i * n because each pixel takes up that number of array slots.
+		inputImage->pixels[i].r = data[i * n + 0];
+		inputImage->pixels[i].g = data[i * n + 1];
+		inputImage->pixels[i].b = data[i * n + 2];
+		// Images without an alpha channel are fully opaque.
+		inputImage->pixels[i].a = n == 4 ? data[i * n + 3] : 0xFF;
+	}
+
+	// Free up image memory.
+	stbi_image_free(data);
+	return true;
+}
+
+// Decodes an image file that has already been read into memory. JPEGs are reduced towards the target size, 0 for full size.
+// Returns false if stb_image can't decode it.
+bool importImageFromMemory(unsigned char *file, size_t size, struct InputImage *inputImage, int targetSize)
+{
+	struct ImageSource source = {0};
+	source.file = file;
+	source.size = size;
+	source.targetSize = targetSize;
+	return importImageFromSource(&source, inputImage);
+}
+
+// A location of "-" stands for stdin as a source and stdout as a destination.
+bool isStandardStream(char *location)
+{
+	return strcmp(location, "-") == 0;
+}
+
+// Stops Windows from translating line endings in image data passed through stdin or stdout.
+void setBinaryMode(FILE *stream)
+{
+#ifdef _WIN32
+	_setmode(_fileno(stream), _O_BINARY);
+#else
+	(void)stream;
+#endif
+}
+
+// Decodes an image as it's read from a stream, without waiting for the whole file first.
+// Returns false if stb_image can't decode it.
+bool importImageFromStream(FILE *stream, struct InputImage *inputImage, int targetSize)
+{
+	struct ImageSource source = {0};
+	source.stream = stream;
+	source.targetSize = targetSize;
+	bool imported = importImageFromSource(&source, inputImage);
+	free(source.replay);
+	return imported;
+}
+
+// Reads and decodes the image at the file location.
+// Returns false if the file can't be read or decoded.
+bool importImage(char *fileLocation, struct InputImage *inputImage, int targetSize)
+{
+	// The image is cleared first, so the caller can free it whether or not it was imported.
+	inputImage->pixels = NULL;
+	inputImage->samples = NULL;
+	inputImage->samples16 = NULL;
+	inputImage->samplesHDR = NULL;
+	inputImage->fileLocation = NULL;
+
+	// A location of "-" decodes the image from stdin as it arrives.
+	if (isStandardStream(fileLocation))
+	{
+		setBinaryMode(stdin);
+		bool imported = importImageFromStream(stdin, inputImage, targetSize);
+		inputImage->fileLocation = malloc(sizeof(char) * 261);
+		strcpy(inputImage->fileLocation, fileLocation);
+		return imported;
+	}
+
+	// The whole file is read once and decoded from memory. This saves stb_image from opening the file
+	// again for each check of the image type.
+	size_t size;
+	unsigned char *file = readFile(fileLocation, &size);
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	bool imported = importImageFromMemory(file, size, inputImage, targetSize);
+	free(file);
+
+	// String for file location has to be preallocated.
+	inputImage->fileLocation = malloc(sizeof(char) * 261);
+	strcpy(inputImage->fileLocation, fileLocation);
+
+	return imported;
+}
+
+// Frees all the memory held by an input image, whichever form its pixels are stored in.
+void freeInputImage(struct InputImage *inputImage)
+{
+	free(inputImage->pixels);
+	stbi_image_free(inputImage->samples);
+	stbi_image_free(inputImage->samples16);
+	stbi_image_free(inputImage->samplesHDR);
+	free(inputImage->fileLocation);
+}
+
+// Returns false if the file could not be written.
+bool exportQOI(char *fileLocation, struct OutputImage *outputImage)
+{
+	// Open file in writing, binary mode.
+	FILE *f = fopen(fileLocation, "wb");
+	if (f == NULL)
+	{
+		return false;
+	}
+
+	// Write all the data stored in the output image.
+	// Provide that there are data size * size of char bytes to write.
+	bool written = fwrite(outputImage->data, sizeof(char), outputImage->dataSize, f) == outputImage->dataSize;
+
+	// A file that couldn't be written fully only holds part of an image.
+	if (fclose(f) != 0 || !written)
+	{
+		remove(fileLocation);
+		return false;
+	}
+	return true;
+}
+
+// Inflate (https://www.rfc-editor.org/rfc/rfc1951) for the image data of PNGs decoded by convertPNGToQOI.
+// stb_image reads its bit buffer one byte at a time and decodes one symbol per loop, which makes inflating the
+// slowest part of converting most PNGs. This decoder keeps 64 bits buffered, refilled with one 8 byte read,
+// which is enough for a length and distance or 3 literals between refills. Symbols are decoded with one table
+// lookup whose entry also holds the base value and extra bits of lengths and distances, and matches are copied
+// 8 bytes at a time.
+
+// Entries of the Huffman decoding tables.
+// Bits 0-3 are the number of bits in the code, bits 4-7 the number of extra bits that follow it (or the size of
+// the subtable), bits 8-11 the type of entry, and bits 16-31 the literal, base length, base distance or subtable position.
+// An entry of 0 is a code that isn't used, which is an error in the data.
+#define INFLATE_LITERAL 0x100
+#define INFLATE_LENGTH 0x200
+#define INFLATE_DISTANCE 0x200
+#define INFLATE_END 0x400
+#define INFLATE_SUBTABLE 0x800
+
+// Codes up to this many bits are decoded with one lookup, longer codes with a second lookup in a subtable.
+#define INFLATE_LITERAL_TABLE_BITS 10
+#define INFLATE_DISTANCE_TABLE_BITS 8
+#define INFLATE_CODE_LENGTH_TABLE_BITS 7
+// The primary table plus the largest possible subtables (32 entries for each 15 bit code, or 128 for distances).
+#define INFLATE_LITERAL_TABLE_SIZE ((1 << INFLATE_LITERAL_TABLE_BITS) + 288 * 32)
+#define INFLATE_DISTANCE_TABLE_SIZE ((1 << INFLATE_DISTANCE_TABLE_BITS) + 32 * 128)
+
+// Everything the decoder needs between blocks.
+struct Inflater
+{
+	unsigned char *input;
+	unsigned char *inputEnd;
+	// Bytes of zeros given after the end of the input. More than are still in the bit buffer means the data was cut short.
+	int overrun;
+	unsigned long long bits;
+	int bitCount;
+
+	unsigned char *output;
+	unsigned char *outputStart;
+	// The end of the output that can be written to. The allocation is 8 bytes larger so that copies can overshoot.
+	unsigned char *outputEnd;
+
+	unsigned int literalTable[INFLATE_LITERAL_TABLE_SIZE];
+	unsigned int distanceTable[INFLATE_DISTANCE_TABLE_SIZE];
+
+	// The entries of the literal and length symbols, distance symbols and code length symbols, without their code lengths.
+	unsigned int literalEntries[288];
+	unsigned int distanceEntries[32];
+	unsigned int codeLengthEntries[19];
+};
+
+// Tops the bit buffer up to at least 56 bits (and at most 63).
+static inline void refillBits(struct Inflater *inflater)
+{
+	if (inflater->inputEnd - inflater->input >= 8)
+	{
+		// Load 8 bytes at once and keep however many whole bytes fit. The bits above the count are the next bytes,
+		// which are loaded into the same position again by the next refill.
+		unsigned long long next = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			next |= (unsigned long long)inflater->input[i] << (i * 8);
+		}
+		inflater->bits |= next << inflater->bitCount;
+		inflater->input += (63 - inflater->bitCount) >> 3;
+		inflater->bitCount |= 56;
+		return;
+	}
+
+	// Near the end of the input, bytes are added one at a time, with zeros after the end.
+	while (inflater->bitCount < 56)
+	{
+		unsigned long long next = 0;
+		if (inflater->input < inflater->inputEnd)
+		{
+			next = *inflater->input;
+			inflater->input++;
+		}
+		else
+		{
+			inflater->overrun++;
+		}
+		inflater->bits |= next << inflater->bitCount;
+		inflater->bitCount += 8;
+	}
+}
+
+// Takes a number of bits (up to 32) from the bit buffer, which must already hold them.
+static inline unsigned int takeBits(struct Inflater *inflater, int count)
+{
+	unsigned int value = inflater->bits & ((1ULL << count) - 1);
+	inflater->bits >>= count;
+	inflater->bitCount -= count;
+	return value;
+}
+
+// Decodes one symbol, returning its table entry. The bit buffer must hold at least 15 bits.
+static inline unsigned int decodeSymbol(struct Inflater *inflater, unsigned int *table, int tableBits)
+{
+	unsigned int entry = table[inflater->bits & ((1 << tableBits) - 1)];
+	if (entry & INFLATE_SUBTABLE)
+	{
+		takeBits(inflater, tableBits);
+		entry = table[(entry >> 16) + (inflater->bits & ((1 << ((entry >> 4) & 15)) - 1))];
+	}
+	takeBits(inflater, entry & 15);
+	return entry;
+}
+
+// Builds the decoding table for a Huffman code from the code length of each symbol.
+// Symbol entries holds the entry for each symbol without its code length.
+// Returns false if the lengths don't form a valid code. Codes that don't use every bit pattern are allowed,
+// and their unused patterns are left as 0.
+bool buildHuffmanTable(unsigned int *table, int tableBits, unsigned char *lengths, const unsigned int *symbolEntries, int count)
+{
+	int lengthCounts[16] = {0};
+	for (int i = 0; i < count; i++)
+	{
+		lengthCounts[lengths[i]]++;
+	}
+	lengthCounts[0] = 0;
+
+	// Codes are assigned in order of length, and then symbol. More codes of a length than there is room for is an error.
+	int nextCode[16];
+	int code = 0;
+	int remaining = 1;
+	for (int length = 1; length < 16; length++)
+	{
+		code = (code + lengthCounts[length - 1]) << 1;
+		nextCode[length] = code;
+		remaining = (remaining << 1) - lengthCounts[length];
+		if (remaining < 0)
+		{
+			return false;
+		}
+	}
+
+	// The code of each symbol, with its bits reversed, as the bits are read from the buffer lowest first.
+	unsigned short codes[288];
+	int tableSize = 1 << tableBits;
+	unsigned char longestCode[1 << INFLATE_LITERAL_TABLE_BITS] = {0};
+	for (int i = 0; i < count; i++)
+	{
+		int length = lengths[i];
+		if (length == 0)
+		{
+			continue;
+		}
+		int forward = nextCode[length]++;
+		int reversed = 0;
+		for (int bit = 0; bit < length; bit++)
+		{
+			reversed |= ((forward >> bit) & 1) << (length - 1 - bit);
+		}
+		codes[i] = reversed;
+
+		// Codes longer than the table share a subtable with the other codes that start with the same bits.
+		if (length > tableBits && length > longestCode[reversed & (tableSize - 1)])
+		{
+			longestCode[reversed & (tableSize - 1)] = length;
+		}
+	}
+
+	memset(table, 0, sizeof(unsigned int) * tableSize);
+	int subtablePosition = tableSize;
+	for (int i = 0; i < tableSize; i++)
+	{
+		if (longestCode[i] != 0)
+		{
+			int subtableBits = longestCode[i] - tableBits;
+			table[i] = subtablePosition << 16 | INFLATE_SUBTABLE | subtableBits << 4 | tableBits;
+			memset(table + subtablePosition, 0, sizeof(unsigned int) << subtableBits);
+			subtablePosition += 1 << subtableBits;
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		int length = lengths[i];
+		if (length == 0)
+		{
+			continue;
+		}
+
+		// Every table position whose low bits are the code decodes to the symbol.
+		if (length <= tableBits)
+		{
+			for (int position = codes[i]; position < tableSize; position += 1 << length)
+			{
+				table[position] = symbolEntries[i] | length;
+			}
+		}
+		else
+		{
+			unsigned int subtable = table[codes[i] & (tableSize - 1)];
+			int subtableSize = 1 << ((subtable >> 4) & 15);
+			for (int position = codes[i] >> tableBits; position < subtableSize; position += 1 << (length - tableBits))
+			{
+				table[(subtable >> 16) + position] = symbolEntries[i] | (length - tableBits);
+			}
+		}
+	}
+
+	return true;
+}
+
+// Fills in the entry of each symbol.
+void createInflateEntries(struct Inflater *inflater)
+{
+	const unsigned short lengthBases[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+	const unsigned char lengthExtraBits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+	const unsigned short distanceBases[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+	const unsigned char distanceExtraBits[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+	for (int i = 0; i < 256; i++)
+	{
+		inflater->literalEntries[i] = i << 16 | INFLATE_LITERAL;
+	}
+	inflater->literalEntries[256] = INFLATE_END;
+	for (int i = 0; i < 29; i++)
+	{
+		inflater->literalEntries[257 + i] = (unsigned int)lengthBases[i] << 16 | INFLATE_LENGTH | lengthExtraBits[i] << 4;
+	}
+	// Symbols 286 and 287 and distances 30 and 31 can appear in the fixed codes, but never in valid data.
+	inflater->literalEntries[286] = 0;
+	inflater->literalEntries[287] = 0;
+	for (int i = 0; i < 30; i++)
+	{
+		inflater->distanceEntries[i] = (unsigned int)distanceBases[i] << 16 | INFLATE_DISTANCE | distanceExtraBits[i] << 4;
+	}
+	inflater->distanceEntries[30] = 0;
+	inflater->distanceEntries[31] = 0;
+	for (int i = 0; i < 19; i++)
+	{
+		inflater->codeLengthEntries[i] = i << 16 | INFLATE_LITERAL;
+	}
+}
+
+// Makes sure there is room for a number of bytes of output, growing it if needed.
+bool reserveOutput(struct Inflater *inflater, size_t size)
+{
+	if ((size_t)(inflater->outputEnd - inflater->output) >= size)
+	{
+		return true;
+	}
+
+	size_t used = inflater->output - inflater->outputStart;
+	size_t capacity = (inflater->outputEnd - inflater->outputStart) * 2;
+	if (capacity < used + size)
+	{
+		capacity = used + size;
+	}
+	unsigned char *output = realloc(inflater->outputStart, capacity + 8);
+	if (output == NULL)
+	{
+		return false;
+	}
+	inflater->outputStart = output;
+	inflater->output = output + used;
+	inflater->outputEnd = output + capacity;
+	return true;
+}
+
+// Reads the code lengths of a dynamic block and builds its tables.
+bool readDynamicCodes(struct Inflater *inflater)
+{
+	const unsigned char codeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	refillBits(inflater);
+	int literalCount = takeBits(inflater, 5) + 257;
+	int distanceCount = takeBits(inflater, 5) + 1;
+	int codeLengthCount = takeBits(inflater, 4) + 4;
+
+	unsigned char codeLengthLengths[19] = {0};
+	for (int i = 0; i < codeLengthCount; i++)
+	{
+		refillBits(inflater);
+		codeLengthLengths[codeLengthOrder[i]] = takeBits(inflater, 3);
+	}
+	unsigned int codeLengthTable[1 << INFLATE_CODE_LENGTH_TABLE_BITS];
+	if (!buildHuffmanTable(codeLengthTable, INFLATE_CODE_LENGTH_TABLE_BITS, codeLengthLengths, inflater->codeLengthEntries, 19))
+	{
+		return false;
+	}
+
+	// The literal and distance code lengths are read as one list, as repeats can cross from one to the other.
+	unsigned char lengths[288 + 32];
+	int count = 0;
+	while (count < literalCount + distanceCount)
+	{
+		refillBits(inflater);
+		unsigned int entry = decodeSymbol(inflater, codeLengthTable, INFLATE_CODE_LENGTH_TABLE_BITS);
+		if (entry == 0)
+		{
+			return false;
+		}
+
+		int symbol = entry >> 16;
+		if (symbol < 16)
+		{
+			lengths[count] = symbol;
+			count++;
+			continue;
+		}
+
+		int repeat;
+		unsigned char value = 0;
+		if (symbol == 16)
+		{
+			// Repeat the previous length 3 to 6 times.
+			if (count == 0)
+			{
+				return false;
+			}
+			value = lengths[count - 1];
+			repeat = takeBits(inflater, 2) + 3;
+		}
+		else if (symbol == 17)
+		{
+			repeat = takeBits(inflater, 3) + 3;
+		}
+		else
+		{
+			repeat = takeBits(inflater, 7) + 11;
+		}
+
+		if (count + repeat > literalCount + distanceCount)
+		{
+			return false;
+		}
+		memset(lengths + count, value, repeat);
+		count += repeat;
+	}
+
+	return buildHuffmanTable(inflater->literalTable, INFLATE_LITERAL_TABLE_BITS, lengths, inflater->literalEntries, literalCount) &&
+		   buildHuffmanTable(inflater->distanceTable, INFLATE_DISTANCE_TABLE_BITS, lengths + literalCount, inflater->distanceEntries, distanceCount);
+}
+
+// Builds the tables of the fixed codes used by block type 1.
+void createFixedCodes(struct Inflater *inflater)
+{
+	unsigned char lengths[288];
+	memset(lengths, 8, 144);
+	memset(lengths + 144, 9, 112);
+	memset(lengths + 256, 7, 24);
+	memset(lengths + 280, 8, 8);
+	buildHuffmanTable(inflater->literalTable, INFLATE_LITERAL_TABLE_BITS, lengths, inflater->literalEntries, 288);
+
+	memset(lengths, 5, 32);
+	buildHuffmanTable(inflater->distanceTable, INFLATE_DISTANCE_TABLE_BITS, lengths, inflater->distanceEntries, 32);
+}
+
+// Copies a match of a length from a distance back in the output.
+static inline void copyMatch(unsigned char *output, int distance, int length)
+{
+	unsigned char *source = output - distance;
+	if (distance >= 8)
+	{
+		// Each 8 bytes are copied from bytes that were already written, even when the match overlaps itself.
+		// Up to 7 bytes past the end of the match are written, which the next symbols write over.
+		for (int i = 0; i < length; i += 8)
+		{
+			memcpy(output + i, source + i, 8);
+		}
+	}
+	else if (distance == 1)
+	{
+		memset(output, source[0], length);
+	}
+	else
+	{
+		for (int i = 0; i < length; i++)
+		{
+			output[i] = source[i];
+		}
+	}
+}
+
+// Decodes the symbols of a compressed block up to its end symbol.
+bool inflateBlock(struct Inflater *inflater)
+{
+	while (true)
+	{
+		// Room for up to 2 literals followed by the longest match. Copies can overshoot into the 8 bytes after the end.
+		if (!reserveOutput(inflater, 2 + 258))
+		{
+			return false;
+		}
+
+		refillBits(inflater);
+		// Data that was cut short would otherwise decode the zeros after its end forever.
+		if (inflater->overrun > 8)
+		{
+			return false;
+		}
+		unsigned int entry = decodeSymbol(inflater, inflater->literalTable, INFLATE_LITERAL_TABLE_BITS);
+
+		// A refill leaves at least 56 bits, so up to 3 literals of at most 15 bits can be decoded from it.
+		if (entry & INFLATE_LITERAL)
+		{
+			*inflater->output++ = entry >> 16;
+			entry = decodeSymbol(inflater, inflater->literalTable, INFLATE_LITERAL_TABLE_BITS);
+			if (entry & INFLATE_LITERAL)
+			{
+				*inflater->output++ = entry >> 16;
+				entry = decodeSymbol(inflater, inflater->literalTable, INFLATE_LITERAL_TABLE_BITS);
+				if (entry & INFLATE_LITERAL)
+				{
+					*inflater->output++ = entry >> 16;
+					continue;
+				}
+			}
+			// Reading a length and distance can take up to 48 bits.
+			refillBits(inflater);
+		}
+
+		if (entry & INFLATE_LENGTH)
+		{
+			int length = (entry >> 16) + takeBits(inflater, (entry >> 4) & 15);
+
+			unsigned int distanceEntry = decodeSymbol(inflater, inflater->distanceTable, INFLATE_DISTANCE_TABLE_BITS);
+			if (!(distanceEntry & INFLATE_DISTANCE))
+			{
+				return false;
+			}
+			int distance = (distanceEntry >> 16) + takeBits(inflater, (distanceEntry >> 4) & 15);
+			if (distance > inflater->output - inflater->outputStart)
+			{
+				return false;
+			}
+
+			copyMatch(inflater->output, distance, length);
+			inflater->output += length;
+		}
+		else if (entry & INFLATE_END)
+		{
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+}
+
+// Inflates zlib data (https://www.rfc-editor.org/rfc/rfc1950), the format of PNG image data.
+// Expected size is how large the output should be, which it starts out as. Returns NULL if the data is broken.
+// Like stb_image, the checksum at the end isn't checked.
+unsigned char *inflateZlib(unsigned char *data, size_t size, size_t expectedSize, size_t *inflatedSize)
+{
+	// The zlib header must use deflate, have a valid check value, and not need a preset dictionary.
+	if (size < 2 || (data[0] & 15) != 8 || (data[0] << 8 | data[1]) % 31 != 0 || (data[1] & 32))
+	{
+		return NULL;
+	}
+
+	struct Inflater *inflater = malloc(sizeof(struct Inflater));
+	createInflateEntries(inflater);
+	inflater->input = data + 2;
+	inflater->inputEnd = data + size;
+	inflater->overrun = 0;
+	inflater->bits = 0;
+	inflater->bitCount = 0;
+	inflater->outputStart = malloc(expectedSize + 8);
+	inflater->output = inflater->outputStart;
+	inflater->outputEnd = inflater->outputStart + expectedSize;
+
+	bool valid = inflater->outputStart != NULL;
+	bool finalBlock = false;
+	while (valid && !finalBlock)
+	{
+		refillBits(inflater);
+		finalBlock = takeBits(inflater, 1);
+		int type = takeBits(inflater, 2);
+
+		if (type == 0)
+		{
+			// Stored block. Skip to the next byte and give back the whole bytes still in the bit buffer,
+			// apart from any zeros that were added after the end.
+			takeBits(inflater, inflater->bitCount & 7);
+			int buffered = (inflater->bitCount >> 3) - inflater->overrun;
+			if (buffered < 0)
+			{
+				valid = false;
+				break;
+			}
+			inflater->input -= buffered;
+			inflater->overrun = 0;
+			inflater->bits = 0;
+			inflater->bitCount = 0;
+			if (inflater->inputEnd - inflater->input < 4)
+			{
+				valid = false;
+				break;
+			}
+
+			unsigned char *input = inflater->input;
+			int length = input[0] | input[1] << 8;
+			int check = input[2] | input[3] << 8;
+			inflater->input += 4;
+			valid = length == (check ^ 0xFFFF) && inflater->inputEnd - inflater->input >= length && reserveOutput(inflater, length);
+			if (valid)
+			{
+				memcpy(inflater->output, inflater->input, length);
+				inflater->output += length;
+				inflater->input += length;
+			}
+		}
+		else if (type == 1)
+		{
+			createFixedCodes(inflater);
+			valid = inflateBlock(inflater);
+		}
+		else if (type == 2)
+		{
+			valid = readDynamicCodes(inflater) && inflateBlock(inflater);
+		}
+		else
+		{
+			valid = false;
+		}
+
+		// Zeros read past the end that were used mean the data was cut short.
+		if (inflater->overrun > inflater->bitCount >> 3)
+		{
+			valid = false;
+		}
+	}
+
+	unsigned char *output = inflater->outputStart;
+	*inflatedSize = inflater->output - inflater->outputStart;
+	free(inflater);
+
+	if (!valid)
+	{
+		free(output);
+		return NULL;
+	}
+	return output;
+}
+
+// PNG color types.
+#define PNG_GRAY 0
+#define PNG_RGB 2
+#define PNG_PALETTE 3
+#define PNG_GRAY_ALPHA 4
+#define PNG_RGBA 6
+
+// PNG row filters. Each row starts with the filter that was used to store it.
+#define PNG_FILTER_NONE 0
+#define PNG_FILTER_SUB 1
+#define PNG_FILTER_UP 2
+#define PNG_FILTER_AVERAGE 3
+#define PNG_FILTER_PAETH 4
+
+// Reads a 4 byte big endian number, the byte order of every number in a PNG.
+static inline unsigned int readBigEndian(unsigned char *bytes)
+{
+	return (unsigned int)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+// The paeth predictor picks whichever of the left, above and above left samples is closest to left + above - above left.
+static inline int paethPredictor(int left, int above, int aboveLeft)
+{
+	int estimate = left + above - aboveLeft;
+	int leftDistance = abs(estimate - left);
+	int aboveDistance = abs(estimate - above);
+	int aboveLeftDistance = abs(estimate - aboveLeft);
+	if (leftDistance <= aboveDistance && leftDistance <= aboveLeftDistance)
+	{
+		return left;
+	}
+	return aboveDistance <= aboveLeftDistance ? above : aboveLeft;
+}
+
+// Plain C version of each filter, used for rows that are too short or have pixels of 1 or 2 bytes.
+// The first row is handled by unfilterPNGRow, so the row above is never NULL.
+void unfilterPNGRowPlain(int filter, unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	switch (filter)
+	{
+	case PNG_FILTER_SUB:
+		for (int i = pixelSize; i < length; i++)
+		{
+			row[i] += row[i - pixelSize];
+		}
+		break;
+	case PNG_FILTER_UP:
+		for (int i = 0; i < length; i++)
+		{
+			row[i] += above[i];
+		}
+		break;
+	case PNG_FILTER_AVERAGE:
+		for (int i = 0; i < pixelSize; i++)
+		{
+			row[i] += above[i] >> 1;
+		}
+		for (int i = pixelSize; i < length; i++)
+		{
+			row[i] += (row[i - pixelSize] + above[i]) >> 1;
+		}
+		break;
+	case PNG_FILTER_PAETH:
+		for (int i = 0; i < pixelSize; i++)
+		{
+			row[i] += above[i];
+		}
+		for (int i = pixelSize; i < length; i++)
+		{
+			row[i] += paethPredictor(row[i - pixelSize], above[i], above[i - pixelSize]);
+		}
+		break;
+	}
+}
+
+#ifdef __SSE2__
+// Loads the bytes of one pixel (3, 4, 6 or 8) into the low bytes of a register, with the rest zero.
+// Pixels that aren't 4 or 8 bytes are read in smaller pieces rather than through a buffer on the stack,
+// which would stall every load waiting for the bytes just written to it.
+static inline __m128i loadPixelSSE2(unsigned char *pixel, int pixelSize)
+{
+	unsigned int low;
+	unsigned short high;
+	switch (pixelSize)
+	{
+	case 3:
+		memcpy(&high, pixel, 2);
+		return _mm_cvtsi32_si128(high | pixel[2] << 16);
+	case 4:
+		memcpy(&low, pixel, 4);
+		return _mm_cvtsi32_si128(low);
+	case 6:
+		memcpy(&low, pixel, 4);
+		memcpy(&high, pixel + 4, 2);
+		return _mm_insert_epi16(_mm_cvtsi32_si128(low), high, 2);
+	default:
+		return _mm_loadl_epi64((__m128i *)pixel);
+	}
+}
+
+// Stores the low bytes of a register as one pixel.
+static inline void storePixelSSE2(unsigned char *pixel, __m128i value, int pixelSize)
+{
+	unsigned int low = _mm_cvtsi128_si32(value);
+	unsigned short high;
+	switch (pixelSize)
+	{
+	case 3:
+		high = (unsigned short)low;
+		memcpy(pixel, &high, 2);
+		pixel[2] = low >> 16;
+		break;
+	case 4:
+		memcpy(pixel, &low, 4);
+		break;
+	case 6:
+		high = _mm_extract_epi16(value, 2);
+		memcpy(pixel, &low, 4);
+		memcpy(pixel + 4, &high, 2);
+		break;
+	default:
+		_mm_storel_epi64((__m128i *)pixel, value);
+	}
+}
+
+// Up adds the byte above to each byte, 16 at a time.
+void unfilterUpSSE2(unsigned char *row, unsigned char *above, int length)
+{
+	int i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i sum = _mm_add_epi8(_mm_loadu_si128((__m128i *)(row + i)), _mm_loadu_si128((__m128i *)(above + i)));
+		_mm_storeu_si128((__m128i *)(row + i), sum);
+	}
+	for (; i < length; i++)
+	{
+		row[i] += above[i];
+	}
+}
+
+// Sub is a running sum of the pixels, which is worked out for 4 pixels of 4 bytes at a time:
+// adding the register to itself shifted by 1 and then 2 pixels gives each pixel the sum of itself and every pixel before it
+// within the register, and the last pixel of the previous 4 is then added to all of them.
+void unfilterSub4SSE2(unsigned char *row, int length)
+{
+	__m128i previous = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i sum = _mm_loadu_si128((__m128i *)(row + i));
+		sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 4));
+		sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 8));
+		sum = _mm_add_epi8(sum, previous);
+		_mm_storeu_si128((__m128i *)(row + i), sum);
+		previous = _mm_shuffle_epi32(sum, 0xFF);
+	}
+	for (i = i > 4 ? i : 4; i < length; i++)
+	{
+		row[i] += row[i - 4];
+	}
+}
+
+// The same running sum for pixels of 3 bytes, 5 at a time. The 16th byte of each register belongs to the next
+// 5 pixels, so it is stored unchanged.
+void unfilterSub3SSE2(unsigned char *row, int length)
+{
+	const __m128i lastByte = _mm_set_epi8(-1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i firstPixel = _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1);
+	__m128i previous = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 16 <= length; i += 15)
+	{
+		__m128i original = _mm_loadu_si128((__m128i *)(row + i));
+		__m128i sum = _mm_add_epi8(original, _mm_slli_si128(original, 3));
+		sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 6));
+		sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 12));
+		sum = _mm_add_epi8(sum, previous);
+		_mm_storeu_si128((__m128i *)(row + i), _mm_or_si128(_mm_andnot_si128(lastByte, sum), _mm_and_si128(lastByte, original)));
+
+		// Repeat the 5th pixel in each of the 5 pixel positions.
+		previous = _mm_and_si128(_mm_srli_si128(sum, 12), firstPixel);
+		previous = _mm_or_si128(previous, _mm_slli_si128(previous, 3));
+		previous = _mm_or_si128(previous, _mm_slli_si128(previous, 6));
+		previous = _mm_or_si128(previous, _mm_slli_si128(previous, 12));
+	}
+	for (i = i > 3 ? i : 3; i < length; i++)
+	{
+		row[i] += row[i - 3];
+	}
+}
+
+// Average and paeth depend on the pixel to the left, so they go one pixel at a time, with every byte of the pixel at once.
+// Pixel size is a constant where this is called, so loading and storing a pixel compiles to plain moves.
+static inline void unfilterAveragePixelsSSE2(unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	const __m128i ones = _mm_set1_epi8(1);
+	__m128i left = _mm_setzero_si128();
+	for (int i = 0; i + pixelSize <= length; i += pixelSize)
+	{
+		__m128i up = loadPixelSSE2(above + i, pixelSize);
+		// _mm_avg_epu8 rounds up, so 1 is taken away where the sum is odd to round down like the filter.
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), ones));
+		left = _mm_add_epi8(loadPixelSSE2(row + i, pixelSize), average);
+		storePixelSSE2(row + i, left, pixelSize);
+	}
+}
+
+// Paeth works with 16 bit samples so the distances can't overflow.
+static inline void unfilterPaethPixelsSSE2(unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowBytes = _mm_set1_epi16(0xFF);
+	__m128i left = zero;
+	__m128i aboveLeft = zero;
+	for (int i = 0; i + pixelSize <= length; i += pixelSize)
+	{
+		__m128i up = _mm_unpacklo_epi8(loadPixelSSE2(above + i, pixelSize), zero);
+
+		// The distances from left + above - above left to left, above and above left.
+		__m128i upDifference = _mm_sub_epi16(up, aboveLeft);
+		__m128i leftDifference = _mm_sub_epi16(left, aboveLeft);
+		__m128i bothDifference = _mm_add_epi16(upDifference, leftDifference);
+		__m128i leftDistance = _mm_max_epi16(upDifference, _mm_sub_epi16(zero, upDifference));
+		__m128i upDistance = _mm_max_epi16(leftDifference, _mm_sub_epi16(zero, leftDifference));
+		__m128i aboveLeftDistance = _mm_max_epi16(bothDifference, _mm_sub_epi16(zero, bothDifference));
+
+		// The same choice as paethPredictor, with masks instead of branches.
+		__m128i notLeft = _mm_or_si128(_mm_cmpgt_epi16(leftDistance, upDistance), _mm_cmpgt_epi16(leftDistance, aboveLeftDistance));
+		__m128i notUp = _mm_cmpgt_epi16(upDistance, aboveLeftDistance);
+		__m128i prediction = _mm_or_si128(_mm_and_si128(notUp, aboveLeft), _mm_andnot_si128(notUp, up));
+		prediction = _mm_or_si128(_mm_and_si128(notLeft, prediction), _mm_andnot_si128(notLeft, left));
+
+		__m128i value = _mm_unpacklo_epi8(loadPixelSSE2(row + i, pixelSize), zero);
+		left = _mm_and_si128(_mm_add_epi16(value, prediction), lowBytes);
+		aboveLeft = up;
+		storePixelSSE2(row + i, _mm_packus_epi16(left, left), pixelSize);
+	}
+}
+
+void unfilterAverageSSE2(unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	switch (pixelSize)
+	{
+	case 3:
+		unfilterAveragePixelsSSE2(row, above, length, 3);
+		break;
+	case 4:
+		unfilterAveragePixelsSSE2(row, above, length, 4);
+		break;
+	case 6:
+		unfilterAveragePixelsSSE2(row, above, length, 6);
+		break;
+	case 8:
+		unfilterAveragePixelsSSE2(row, above, length, 8);
+		break;
+	default:
+		unfilterPNGRowPlain(PNG_FILTER_AVERAGE, row, above, length, pixelSize);
+	}
+}
+
+void unfilterPaethSSE2(unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	switch (pixelSize)
+	{
+	case 3:
+		unfilterPaethPixelsSSE2(row, above, length, 3);
+		break;
+	case 4:
+		unfilterPaethPixelsSSE2(row, above, length, 4);
+		break;
+	case 6:
+		unfilterPaethPixelsSSE2(row, above, length, 6);
+		break;
+	case 8:
+		unfilterPaethPixelsSSE2(row, above, length, 8);
+		break;
+	default:
+		unfilterPNGRowPlain(PNG_FILTER_PAETH, row, above, length, pixelSize);
+	}
+}
+#endif
+
+#ifdef AVX2_DISPATCH
+// Up with 32 bytes at a time. The other filters depend on the pixel to the left, so they gain nothing from wider registers.
+__attribute__((target("avx2"))) void unfilterUpAVX2(unsigned char *row, unsigned char *above, int length)
+{
+	int i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i sum = _mm256_add_epi8(_mm256_loadu_si256((__m256i *)(row + i)), _mm256_loadu_si256((__m256i *)(above + i)));
+		_mm256_storeu_si256((__m256i *)(row + i), sum);
+	}
+	for (; i < length; i++)
+	{
+		row[i] += above[i];
+	}
+}
+#endif
+
+// Reverses the filter of one PNG row in place with the given kernel, using the row above that has already been unfiltered.
+// The first row has no row above, which is treated as a row of zeros.
+// Pixel size is the number of bytes per pixel (at least 1), which is how far back the left sample is.
+void unfilterPNGRowWith(int kernel, int filter, unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	if (above == NULL)
+	{
+		// With a row of zeros above, up changes nothing, and paeth always picks the left sample like sub.
+		if (filter == PNG_FILTER_UP)
+		{
+			return;
+		}
+		if (filter == PNG_FILTER_PAETH)
+		{
+			filter = PNG_FILTER_SUB;
+		}
+		if (filter == PNG_FILTER_AVERAGE)
+		{
+			for (int i = pixelSize; i < length; i++)
+			{
+				row[i] += row[i - pixelSize] >> 1;
+			}
+			return;
+		}
+	}
+
+#ifdef __SSE2__
+	if (kernel != KERNEL_PLAIN)
+	{
+		switch (filter)
+		{
+		case PNG_FILTER_SUB:
+			if (pixelSize == 4)
+			{
+				unfilterSub4SSE2(row, length);
+				return;
+			}
+			if (pixelSize == 3)
+			{
+				unfilterSub3SSE2(row, length);
+				return;
+			}
+			break;
+		case PNG_FILTER_UP:
+#ifdef AVX2_DISPATCH
+			if (kernel == KERNEL_AVX2)
+			{
+				unfilterUpAVX2(row, above, length);
+				return;
+			}
+#endif
+			unfilterUpSSE2(row, above, length);
+			return;
+		case PNG_FILTER_AVERAGE:
+			unfilterAverageSSE2(row, above, length, pixelSize);
+			return;
+		case PNG_FILTER_PAETH:
+			unfilterPaethSSE2(row, above, length, pixelSize);
+			return;
+		}
+	}
+#endif
+
+	unfilterPNGRowPlain(filter, row, above, length, pixelSize);
+}
+
+// Reverses the filter of one PNG row with the best kernel the processor supports.
+void unfilterPNGRow(int filter, unsigned char *row, unsigned char *above, int length, int pixelSize)
+{
+	unfilterPNGRowWith(getBestKernel(), filter, row, above, length, pixelSize);
+}
+
+// Everything convertPNGToQOI reads from the chunks before the image data.
+struct PNGHeader
+{
+	unsigned int width;
+	unsigned int height;
+	int depth;
+	int colorType;
+	// The number of samples stored per pixel (1 for palette indices).
+	int channels;
+	struct Pixel palette[256];
+	int paletteSize;
+	// Gray and RGB images can have one color that is transparent instead of an alpha channel.
+	bool hasTransparentColor;
+	unsigned short transparentColor[3];
+	// The compressed image data. Points into the file when the image is stored in one IDAT chunk.
+	unsigned char *data;
+	size_t dataSize;
+	bool dataAllocated;
+};
+
+// Reads the chunks of a PNG up to its end, keeping what is needed to decode it.
+// Returns false for files that aren't PNGs, interlaced PNGs, and anything else left to stb_image. It follows
+// the same rules as stb_image, so stb_image reports the same errors for a broken file.
+bool readPNGHeader(unsigned char *file, size_t size, struct PNGHeader *header)
+{
+	header->width = 0;
+	header->paletteSize = 0;
+	header->hasTransparentColor = false;
+	header->data = NULL;
+	header->dataSize = 0;
+	header->dataAllocated = false;
+	// Indices beyond the end of the palette are opaque black.
+	for (int i = 0; i < 256; i++)
+	{
+		header->palette[i] = (struct Pixel){0, 0, 0, 0xFF};
+	}
+
+	// The header is set up first, so the caller can free its data whether or not the file is a PNG.
+	const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	if (size < 8 || memcmp(file, signature, 8) != 0)
+	{
+		return false;
+	}
+
+	size_t position = 8;
+	int dataChunkCount = 0;
+	// The first pass finds the image data. If it's split over several chunks, a second pass joins them.
+	size_t firstDataChunk = 0;
+
+	while (true)
+	{
+		if (position + 12 > size)
+		{
+			return false;
+		}
+		unsigned int length = readBigEndian(file + position);
+		unsigned char *type = file + position + 4;
+		unsigned char *chunk = file + position + 8;
+		if (length > size - position - 12)
+		{
+			return false;
+		}
+
+		if (memcmp(type, "IHDR", 4) == 0)
+		{
+			if (header->width != 0 || length != 13)
+			{
+				return false;
+			}
+			header->width = readBigEndian(chunk);
+			header->height = readBigEndian(chunk + 4);
+			header->depth = chunk[8];
+			header->colorType = chunk[9];
+			int depth = header->depth;
+			// Compression and filter methods must be 0. Interlaced images are left to stb_image.
+			if (chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0)
+			{
+				return false;
+			}
+			if (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16)
+			{
+				return false;
+			}
+			if (header->colorType == PNG_PALETTE)
+			{
+				header->channels = 1;
+				if (depth == 16)
+				{
+					return false;
+				}
+			}
+			else if (header->colorType == PNG_GRAY || header->colorType == PNG_RGB || header->colorType == PNG_GRAY_ALPHA || header->colorType == PNG_RGBA)
+			{
+				header->channels = (header->colorType & 2 ? 3 : 1) + (header->colorType & 4 ? 1 : 0);
+			}
+			else
+			{
+				return false;
+			}
+			if (header->width == 0 || header->height == 0 || header->width > STBI_MAX_DIMENSIONS || header->height > STBI_MAX_DIMENSIONS)
+			{
+				return false;
+			}
+			// The same limit on the decoded size as stb_image.
+			if ((1 << 30) / header->width / 4 < header->height)
+			{
+				return false;
+			}
+		}
+		else if (header->width == 0)
+		{
+			// IHDR must be first.
+			return false;
+		}
+		else if (memcmp(type, "PLTE", 4) == 0)
+		{
+			if (length > 256 * 3 || length % 3 != 0)
+			{
+				return false;
+			}
+			header->paletteSize = length / 3;
+			for (int i = 0; i < header->paletteSize; i++)
+			{
+				header->palette[i] = (struct Pixel){chunk[i * 3], chunk[i * 3 + 1], chunk[i * 3 + 2], 0xFF};
+			}
+		}
+		else if (memcmp(type, "tRNS", 4) == 0)
+		{
+			if (dataChunkCount > 0)
+			{
+				return false;
+			}
+			if (header->colorType == PNG_PALETTE)
+			{
+				// The palette's alpha values.
+				if (header->paletteSize == 0 || (int)length > header->paletteSize)
+				{
+					return false;
+				}
+				for (unsigned int i = 0; i < length; i++)
+				{
+					header->palette[i].a = chunk[i];
+				}
+			}
+			else
+			{
+				// Images with alpha can't also have a transparent color.
+				if (header->channels % 2 == 0 || length != (unsigned int)header->channels * 2)
+				{
+					return false;
+				}
+				header->hasTransparentColor = true;
+				for (int i = 0; i < header->channels; i++)
+				{
+					header->transparentColor[i] = chunk[i * 2] << 8 | chunk[i * 2 + 1];
+				}
+			}
+		}
+		else if (memcmp(type, "IDAT", 4) == 0)
+		{
+			if (header->colorType == PNG_PALETTE && header->paletteSize == 0)
+			{
+				return false;
+			}
+			if (dataChunkCount == 0)
+			{
+				firstDataChunk = position;
+			}
+			dataChunkCount++;
+			header->dataSize += length;
+		}
+		else if (memcmp(type, "IEND", 4) == 0)
+		{
+			break;
+		}
+		else if ((type[0] & 0x20) == 0)
+		{
+			// The chunk is critical (its first letter is upper case), but isn't known. This includes CgBI, Apple's
+			// variant of PNG, which stb_image decodes.
+			return false;
+		}
+
+		position += length + 12;
+	}
+
+	if (dataChunkCount == 0)
+	{
+		return false;
+	}
+
+	if (dataChunkCount == 1)
+	{
+		header->data = file + firstDataChunk + 8;
+		return true;
+	}
+
+	// Join the image data of every IDAT chunk.
+	header->data = malloc(header->dataSize);
+	header->dataAllocated = true;
+	size_t dataIndex = 0;
+	for (position = firstDataChunk; memcmp(file + position + 4, "IEND", 4) != 0; position += readBigEndian(file + position) + 12)
+	{
+		if (memcmp(file + position + 4, "IDAT", 4) == 0)
+		{
+			unsigned int length = readBigEndian(file + position);
+			memcpy(header->data + dataIndex, file + position + 8, length);
+			dataIndex += length;
+		}
+	}
+	return true;
+}
+
+// Gets the sample at index x of a row with samples smaller than a byte (1, 2 or 4 bits, first sample in the highest bits).
+static inline int getPackedSample(unsigned char *row, int x, int depth)
+{
+	int bit = x * depth;
+	return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1 << depth) - 1);
+}
+
+// Encoder state for palette images, which are encoded from their palette indices instead of their pixels.
+// Every pixel is one of at most 256 colors, so the QOI hash of each color is worked out once, and runs and
+// running array hits are found by comparing indices instead of whole pixels.
+struct PaletteEncoder
+{
+	struct Pixel colors[256];
+	unsigned char hashes[256];
+	// Palettes can hold the same color more than once. Every index is mapped to the first index with its color,
+	// so 2 pixels have the same color exactly when they have the same index.
+	unsigned char sameColor[256];
+	// The index of the color at each position of the encoder's running array, or -1 for a color not in the palette.
+	short runningIndices[64];
+	short previousIndex;
+};
+
+// Finds the index of the first palette color that matches the pixel, or -1 if there isn't one.
+short findPaletteColor(struct PaletteEncoder *encoder, int colorCount, struct Pixel pixel)
+{
+	for (int i = 0; i < colorCount; i++)
+	{
+		if (matchingPixels(&encoder->colors[i], &pixel))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Sets up a palette encoder to match an encoder state that was just started.
+void startPaletteEncoder(struct PaletteEncoder *encoder, struct Pixel *palette, int colorCount)
+{
+	// Colors with the same hash are chained together, so each color is only compared to the few before it with its hash.
+	short firstWithHash[64];
+	short nextWithHash[256];
+	for (int i = 0; i < 64; i++)
+	{
+		firstWithHash[i] = -1;
+	}
+
+	for (int i = 0; i < colorCount; i++)
+	{
+		encoder->colors[i] = palette[i];
+		encoder->hashes[i] = getQOIHash(&palette[i]);
+		encoder->sameColor[i] = i;
+
+		short *link = &firstWithHash[encoder->hashes[i]];
+		while (*link != -1 && !matchingPixels(&encoder->colors[*link], &palette[i]))
+		{
+			link = &nextWithHash[*link];
+		}
+		if (*link != -1)
+		{
+			encoder->sameColor[i] = *link;
+		}
+		else
+		{
+			*link = i;
+			nextWithHash[i] = -1;
+		}
+	}
+
+	// The running array starts as (0,0,0,0), which only a pixel with that color can match.
+	// It's at position 0, the hash of (0,0,0,0).
+	for (int i = 0; i < 64; i++)
+	{
+		encoder->runningIndices[i] = -1;
+	}
+	encoder->runningIndices[0] = findPaletteColor(encoder, colorCount, (struct Pixel){0, 0, 0, 0});
+	// The previous pixel starts as (0,0,0,255).
+	encoder->previousIndex = findPaletteColor(encoder, colorCount, (struct Pixel){0, 0, 0, 0xFF});
+}
+
+// Encodes one pixel of a palette image from its index, giving the same bytes as encodePixel with its color.
+// Runs and running array hits only compare indices. Every other pixel needs the difference from the previous
+// pixel's color, which encodePixel works out.
+static inline void encodePaletteIndex(struct EncoderState *state, struct PaletteEncoder *encoder, int index)
+{
+	index = encoder->sameColor[index];
+
+	if (index == encoder->previousIndex)
+	{
+		if (state->run == 62)
+		{
+			saveRun(state->data, &state->run, &state->dataIndex);
+		}
+		state->run++;
+		return;
+	}
+	encoder->previousIndex = index;
+
+	if (state->run > 0)
+	{
+		saveRun(state->data, &state->run, &state->dataIndex);
+	}
+
+	unsigned char hash = encoder->hashes[index];
+	if (encoder->runningIndices[hash] == index)
+	{
+		// OP_INDEX
+		state->data[state->dataIndex] = hash;
+		state->dataIndex++;
+		state->prevPixel = encoder->colors[index];
+		return;
+	}
+
+	// encodePixel keeps the running array the same as the running indices.
+	encodePixel(state, encoder->colors[index]);
+	encoder->runningIndices[hash] = index;
+}
+
+// Encodes a row of 8 bit palette indices.
+// Repeated indices are counted with a byte comparison and added to the run together, which matters for the
+// long runs of flat color common in palette images.
+void encodePaletteRow(struct EncoderState *state, struct PaletteEncoder *encoder, unsigned char *indices, int width)
+{
+	int x = 0;
+	while (x < width)
+	{
+		unsigned char index = indices[x];
+		int end = x + 1;
+		while (end < width && indices[end] == index)
+		{
+			end++;
+		}
+
+		encodePaletteIndex(state, encoder, index);
+
+		// The rest of the repeated pixels are the same as the previous pixel, so they all extend the run.
+		int repeats = end - x - 1;
+		while (repeats > 0)
+		{
+			if (state->run == 62)
+			{
+				saveRun(state->data, &state->run, &state->dataIndex);
+			}
+			int count = 62 - state->run < repeats ? 62 - state->run : repeats;
+			state->run += count;
+			repeats -= count;
+		}
+		x = end;
+	}
+}
+
+// Decodes a PNG one row at a time, passing each unfiltered row straight to the encoder in the PNG's own format.
+// Palette indices are looked up as each pixel is encoded, and gray, RGB and 16 bit rows are encoded without
+// first being expanded to RGBA. stb_image would instead convert the whole image to its output format in one pass,
+// which importImage would then copy into pixels in another.
+// The QOI is the same as the one from importImage and convertToQOI.
+// Returns false without encoding anything for images that this doesn't handle, which are left to stb_image.
+bool convertPNGToQOI(unsigned char *file, size_t size, struct OutputImage *outputImage, struct Options *options)
+{
+	struct PNGHeader header;
+	if (!readPNGHeader(file, size, &header))
+	{
+		if (header.dataAllocated)
+		{
+			free(header.data);
+		}
+		return false;
+	}
+
+	int width = header.width;
+	int height = header.height;
+	int depth = header.depth;
+	// Each row has a filter byte before its samples.
+	int rowLength = (width * header.channels * depth + 7) / 8;
+	int pixelSize = header.channels * depth / 8 > 0 ? header.channels * depth / 8 : 1;
+	size_t decodedSize = (size_t)(rowLength + 1) * height;
+
+	// The image data is inflated all at once, the same as stb_image does.
+	size_t inflatedSize;
+	unsigned char *rows = inflateZlib(header.data, header.dataSize, decodedSize, &inflatedSize);
+	if (header.dataAllocated)
+	{
+		free(header.data);
+	}
+
+	// Check every filter before encoding anything, so a broken image is never partly written to a streamed output.
+	bool valid = rows != NULL && inflatedSize >= decodedSize;
+	for (int y = 0; valid && y < height; y++)
+	{
+		valid = rows[(size_t)y * (rowLength + 1)] <= PNG_FILTER_PAETH;
+	}
+	if (!valid)
+	{
+		free(rows);
+		return false;
+	}
+
+	// The channels of the image stb_image would decode. A transparent color becomes an alpha channel.
+	int outputChannels = header.colorType == PNG_PALETTE ? 4 : header.channels + (header.hasTransparentColor ? 1 : 0);
+	// The QOI header matches what convertToQOI writes for that image. 8 bit RGB images are expanded to RGBA pixels,
+	// which are always saved as 4 channels, while the gray and 16 bit kernels only save 4 when there is alpha.
+	bool expandedToRGBA = depth <= 8 && outputChannels >= 3;
+	struct EncoderState state;
+	startQOI(&state, outputImage, width, height, expandedToRGBA || outputChannels == 2 || outputChannels == 4 ? 4 : 3, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	// 16 bit rows are reduced to 8 bits in a row buffer, including the alpha of a transparent color.
+	unsigned short *row16 = NULL;
+	unsigned short *thresholds = NULL;
+	unsigned char *row8 = NULL;
+	if (depth == 16)
+	{
+		row16 = malloc(sizeof(unsigned short) * width * outputChannels);
+		thresholds = create16BitThresholds(outputChannels, width * outputChannels, options);
+		row8 = malloc(width * outputChannels);
+	}
+
+	// Palette images are encoded from their indices. Indices beyond the end of the palette are still looked up,
+	// so every index the bit depth allows is included. The alpha transform is applied to the palette instead of
+	// every pixel, which also lets transparent colors that become the same be found as the same color.
+	struct PaletteEncoder *paletteEncoder = NULL;
+	if (header.colorType == PNG_PALETTE)
+	{
+		if (options->alphaTransform != ALPHA_KEEP)
+		{
+			transformAlpha(options->alphaTransform, header.palette, 1 << depth, header.palette);
+		}
+		paletteEncoder = malloc(sizeof(struct PaletteEncoder));
+		startPaletteEncoder(paletteEncoder, header.palette, 1 << depth);
+	}
+
+	// Gray samples smaller than a byte are scaled up to use the range from 0 to 255.
+	int scale = depth < 8 ? 255 / ((1 << depth) - 1) : 1;
+	// The transparent color of an 8 bit or smaller image is compared to samples after scaling.
+	unsigned char transparent[3];
+	for (int i = 0; i < 3; i++)
+	{
+		transparent[i] = (unsigned char)((header.transparentColor[i] & 0xFF) * scale);
+	}
+
+	unsigned char *above = NULL;
+	for (int y = 0; y < height; y++)
+	{
+		unsigned char *row = rows + (size_t)y * (rowLength + 1) + 1;
+		unfilterPNGRow(row[-1], row, above, rowLength, pixelSize);
+		above = row;
+
+		if (header.colorType == PNG_PALETTE)
+		{
+			if (depth == 8)
+			{
+				encodePaletteRow(&state, paletteEncoder, row, width);
+			}
+			else
+			{
+				for (int x = 0; x < width; x++)
+				{
+					encodePaletteIndex(&state, paletteEncoder, getPackedSample(row, x, depth));
+				}
+			}
+		}
+		else if (depth == 16)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				bool isTransparent = header.hasTransparentColor;
+				for (int c = 0; c < header.channels; c++)
+				{
+					unsigned short sample = row[(x * header.channels + c) * 2] << 8 | row[(x * header.channels + c) * 2 + 1];
+					row16[x * outputChannels + c] = sample;
+					isTransparent = isTransparent && sample == header.transparentColor[c];
+				}
+				if (header.hasTransparentColor)
+				{
+					row16[x * outputChannels + header.channels] = isTransparent ? 0 : 0xFFFF;
+				}
+			}
+			convert16BitRow(row16, thresholds + (y % 4) * width * outputChannels, row8, width * outputChannels);
+			encodeSampleRow(&state, row8, outputChannels, width);
+		}
+		else if (header.colorType == PNG_GRAY && (depth < 8 || header.hasTransparentColor))
+		{
+			for (int x = 0; x < width; x++)
+			{
+				unsigned char value = depth < 8 ? getPackedSample(row, x, depth) * scale : row[x];
+				unsigned char alpha = header.hasTransparentColor && value == transparent[0] ? 0x00 : 0xFF;
+				encodeGrayPixel(&state, transformSample(state.alphaTransform, value, alpha), alpha);
+			}
+		}
+		else if (header.colorType == PNG_RGB && header.hasTransparentColor)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				struct Pixel pixel = {row[x * 3], row[x * 3 + 1], row[x * 3 + 2], 0xFF};
+				if (pixel.r == transparent[0] && pixel.g == transparent[1] && pixel.b == transparent[2])
+				{
+					pixel.a = 0x00;
+					// Every alpha transform makes transparent pixels black.
+					if (state.alphaTransform != ALPHA_KEEP)
+					{
+						pixel = (struct Pixel){0x00, 0x00, 0x00, 0x00};
+					}
+				}
+				encodePixel(&state, pixel);
+			}
+		}
+		else
+		{
+			// 8 bit gray, gray and alpha, RGB and RGBA rows are already in the form encodeSampleRow takes.
+			encodeSampleRow(&state, row, header.channels, width);
+		}
+
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+
+	free(rows);
+	free(paletteEncoder);
+	free(row16);
+	free(thresholds);
+	free(row8);
+	return true;
+}
+
+// An uncompressed image that is encoded straight from the file it is stored in, without decoding it first.
+struct DirectImage
+{
+	// The first row of the image, and the bytes from the start of one row to the next. The pitch is negative
+	// when the rows are stored from the bottom of the image up.
+	unsigned char *base;
+	ptrdiff_t pitch;
+	int width;
+	int height;
+	// The byte order of color pixels, or NULL for gray samples.
+	const struct PixelFormat *format;
+	// The samples per pixel of gray images, 1 (gray) or 2 (gray, alpha).
+	int channels;
+	// The channels written in the header, which match what convertToQOI saves the decoded image with.
+	unsigned char headerChannels;
+};
+
+// The size of the header at the start of every BMP file, before the header that describes the image.
+#define BMP_FILE_HEADER_SIZE 14
+
+static inline unsigned int readLittleEndian(unsigned char *bytes)
+{
+	return (unsigned int)bytes[0] | (unsigned int)bytes[1] << 8 | (unsigned int)bytes[2] << 16 | (unsigned int)bytes[3] << 24;
+}
+
+// Reads an uncompressed 24 or 32 bit BMP in place. BMP rows are usually stored from the bottom of the image up,
+// which stb_image swaps into order in a pass over the decoded image. Here they are walked with a negative pitch
+// instead. The pixels match what stb_image decodes.
+// Returns false for any other BMP, or a file that isn't one, which are left to stb_image.
+bool readBMPImage(unsigned char *file, size_t size, struct DirectImage *image)
+{
+	if (size < BMP_FILE_HEADER_SIZE + 40 || file[0] != 'B' || file[1] != 'M')
+	{
+		return false;
+	}
+	unsigned int offset = readLittleEndian(file + 10);
+	unsigned int headerSize = readLittleEndian(file + 14);
+	int width = (int)readLittleEndian(file + 18);
+	int height = (int)readLittleEndian(file + 22);
+	int planes = file[26] | file[27] << 8;
+	int bitsPerPixel = file[28] | file[29] << 8;
+	unsigned int compression = readLittleEndian(file + 30);
+
+	// Pixels are either BI_RGB (compression 0), or BI_BITFIELDS (compression 3) with masks that give the same byte
+	// order. The masks follow a 40 byte header and are part of the larger ones. stb_image reads the masks of a
+	// 56 byte header from after it instead, so those are left to stb_image.
+	bool bitfields = compression == 3;
+	if ((headerSize != 40 && headerSize != 108 && headerSize != 124) || planes != 1 ||
+		!((bitsPerPixel == 24 && compression == 0) || (bitsPerPixel == 32 && (compression == 0 || bitfields))))
+	{
+		return false;
+	}
+	unsigned int pixelsStart = BMP_FILE_HEADER_SIZE + headerSize + (bitfields && headerSize == 40 ? 12 : 0);
+	if (size < pixelsStart)
+	{
+		return false;
+	}
+	bool hasAlpha = bitsPerPixel == 32;
+	if (bitfields)
+	{
+		unsigned char *masks = file + BMP_FILE_HEADER_SIZE + 40;
+		unsigned int alphaMask = headerSize >= 108 ? readLittleEndian(masks + 12) : 0;
+		if (readLittleEndian(masks) != 0xFF0000 || readLittleEndian(masks + 4) != 0xFF00 || readLittleEndian(masks + 8) != 0xFF ||
+			(alphaMask != 0 && alphaMask != 0xFF000000))
+		{
+			return false;
+		}
+		hasAlpha = alphaMask != 0;
+	}
+
+	// A positive height is stored bottom up, and a negative one top down.
+	bool bottomUp = height > 0;
+	if (width <= 0 || width > STBI_MAX_DIMENSIONS || height == 0 || height > STBI_MAX_DIMENSIONS || height < -STBI_MAX_DIMENSIONS)
+	{
+		return false;
+	}
+	height = bottomUp ? height : -height;
+
+	// Each row is padded to a multiple of 4 bytes. stb_image only accepts pixels straight after the headers, and
+	// decodes a file that is cut short with zeros, so both are left to it.
+	int pixelSize = bitsPerPixel / 8;
+	size_t stride = ((size_t)width * pixelSize + 3) & ~(size_t)3;
+	if (offset != pixelsStart || size - pixelsStart < stride * (height - 1) + (size_t)width * pixelSize)
+	{
+		return false;
+	}
+
+	// Many programs leave the fourth byte of a BI_RGB pixel unused as 0, so stb_image only keeps it as alpha
+	// when it isn't 0 everywhere. Checking stops at the first pixel with alpha.
+	unsigned char *pixels = file + pixelsStart;
+	if (hasAlpha && !bitfields)
+	{
+		hasAlpha = false;
+		for (int y = 0; y < height && !hasAlpha; y++)
+		{
+			unsigned char *row = pixels + y * stride;
+			for (int x = 0; x < width && !hasAlpha; x++)
+			{
+				hasAlpha = row[x * 4 + 3] != 0;
+			}
+		}
+	}
+
+	image->base = pixels;
+	image->pitch = (ptrdiff_t)stride;
+	if (bottomUp)
+	{
+		flipRows(&image->base, &image->pitch, height);
+	}
+	image->width = width;
+	image->height = height;
+	image->format = findPixelFormat(bitsPerPixel == 24 ? "bgr" : hasAlpha ? "bgra" : "bgrx");
+	image->channels = 4;
+	image->headerChannels = 4;
+	return true;
+}
+
+// The size of the header at the start of every TGA file, which is followed by an ID of up to 255 bytes.
+#define TGA_HEADER_SIZE 18
+
+// TGA headers have no signature, so stb_image only checks for a TGA after every other format. A file is only
+// read as a TGA when stb_image would decode it as one.
+bool isTGAFile(unsigned char *file, size_t size)
+{
+	// The checks only read the start of the file.
+	stbi__context context;
+	stbi__start_mem(&context, file, size > 0x7FFFFFFF ? 0x7FFFFFFF : (int)size);
+	return !stbi__png_test(&context) && !stbi__bmp_test(&context) && !stbi__gif_test(&context) && !stbi__psd_test(&context) &&
+		   !stbi__pic_test(&context) && !stbi__jpeg_test(&context) && !stbi__pnm_test(&context) && !stbi__hdr_test(&context) &&
+		   stbi__tga_test(&context);
+}
+
+// Reads an uncompressed 24 or 32 bit color TGA, or an 8 bit gray or 16 bit gray and alpha one, in place.
+// Rows are stored bottom up unless bit 5 of the descriptor is set, and pixels are stored BGR(A).
+// Returns false for any other TGA, or a file that isn't one, which are left to stb_image.
+bool readTGAImage(unsigned char *file, size_t size, struct DirectImage *image)
+{
+	if (size < TGA_HEADER_SIZE || !isTGAFile(file, size))
+	{
+		return false;
+	}
+	int idLength = file[0];
+	int colorMapType = file[1];
+	int imageType = file[2];
+	int width = file[12] | file[13] << 8;
+	int height = file[14] | file[15] << 8;
+	int bitsPerPixel = file[16];
+	int descriptor = file[17];
+
+	// Image type 2 is uncompressed color and 3 is uncompressed gray.
+	bool color = imageType == 2 && (bitsPerPixel == 24 || bitsPerPixel == 32);
+	bool gray = imageType == 3 && (bitsPerPixel == 8 || bitsPerPixel == 16);
+	if (colorMapType != 0 || !(color || gray))
+	{
+		return false;
+	}
+
+	// stb_image decodes a file that is cut short with what it could read, so that is left to it.
+	int pixelSize = bitsPerPixel / 8;
+	size_t pixelsStart = TGA_HEADER_SIZE + idLength;
+	size_t stride = (size_t)width * pixelSize;
+	if (size < pixelsStart || size - pixelsStart < stride * height)
+	{
+		return false;
+	}
+
+	image->base = file + pixelsStart;
+	image->pitch = (ptrdiff_t)stride;
+	if ((descriptor & 0x20) == 0)
+	{
+		flipRows(&image->base, &image->pitch, height);
+	}
+	image->width = width;
+	image->height = height;
+	image->format = color ? findPixelFormat(bitsPerPixel == 24 ? "bgr" : "bgra") : NULL;
+	image->channels = color ? 4 : pixelSize;
+	image->headerChannels = color || pixelSize == 2 ? 4 : 3;
+	return true;
+}
+
+// Reads the header of a PNM image, either from a file in memory or from a stream.
+struct PNMReader
+{
+	unsigned char *file;
+	size_t size;
+	// The stream the header is read from, or NULL to read it from the file.
+	FILE *stream;
+	// The number of bytes read so far.
+	size_t position;
+};
+
+// Checks if the whole file has been read. A stream only knows by trying to read another byte.
+static inline bool isPNMEnd(struct PNMReader *reader)
+{
+	if (reader->stream == NULL)
+	{
+		return reader->position >= reader->size;
+	}
+	int c = getc(reader->stream);
+	if (c == EOF)
+	{
+		return true;
+	}
+	ungetc(c, reader->stream);
+	return false;
+}
+
+// Reads the next character of a PNM header, or 0 past the end of the file, the same as stb_image does.
+static inline char readPNMCharacter(struct PNMReader *reader)
+{
+	if (reader->stream != NULL)
+	{
+		int c = getc(reader->stream);
+		if (c == EOF)
+		{
+			return 0;
+		}
+		reader->position++;
+		return (char)c;
+	}
+	return reader->position < reader->size ? (char)reader->file[reader->position++] : 0;
+}
+
+static inline bool isPNMSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Skips whitespace and comments in a PNM header. C is the character that has already been read.
+void skipPNMSpace(struct PNMReader *reader, char *c)
+{
+	while (true)
+	{
+		while (!isPNMEnd(reader) && isPNMSpace(*c))
+		{
+			*c = readPNMCharacter(reader);
+		}
+		if (isPNMEnd(reader) || *c != '#')
+		{
+			break;
+		}
+		while (!isPNMEnd(reader) && *c != '\n' && *c != '\r')
+		{
+			*c = readPNMCharacter(reader);
+		}
+	}
+}
+
+// Reads a number in a PNM header, starting with the character that has already been read. Like stb_image, a digit
+// that is the last character of the file isn't included. Returns -1 for a number too large to be a size.
+int readPNMInteger(struct PNMReader *reader, char *c)
+{
+	int value = 0;
+	while (!isPNMEnd(reader) && *c >= '0' && *c <= '9')
+	{
+		value = value * 10 + (*c - '0');
+		if (value > STBI_MAX_DIMENSIONS)
+		{
+			return -1;
+		}
+		*c = readPNMCharacter(reader);
+	}
+	return value;
+}
+
+// Reads the header of a PAM (P7) image after its magic number, which is a line for each of its values ending
+// with ENDHDR. Returns false if the header is broken.
+bool readPAMHeader(struct PNMReader *reader, int *width, int *height, int *depth, int *maxValue)
+{
+	*width = 0;
+	*height = 0;
+	*depth = 0;
+	*maxValue = 0;
+	while (true)
+	{
+		char c = readPNMCharacter(reader);
+		skipPNMSpace(reader, &c);
+		if (isPNMEnd(reader))
+		{
+			return false;
+		}
+
+		char key[16];
+		int length = 0;
+		while (!isPNMSpace(c) && !isPNMEnd(reader) && length < 15)
+		{
+			key[length++] = c;
+			c = readPNMCharacter(reader);
+		}
+		key[length] = '\0';
+
+		// The pixels start after the line that ends the header. The tuple type is a name for what the channels are,
+		// which the depth already says.
+		if (strcmp(key, "ENDHDR") == 0 || strcmp(key, "TUPLTYPE") == 0)
+		{
+			while (c != '\n' && !isPNMEnd(reader))
+			{
+				c = readPNMCharacter(reader);
+			}
+			if (key[0] == 'E')
+			{
+				return c == '\n';
+			}
+			continue;
+		}
+
+		int *value = strcmp(key, "WIDTH") == 0 ? width : strcmp(key, "HEIGHT") == 0 ? height : strcmp(key, "DEPTH") == 0 ? depth : strcmp(key, "MAXVAL") == 0 ? maxValue : NULL;
+		if (value == NULL)
+		{
+			return false;
+		}
+		skipPNMSpace(reader, &c);
+		*value = readPNMInteger(reader, &c);
+		if (*value <= 0 || !isPNMSpace(c))
+		{
+			return false;
+		}
+	}
+}
+
+// Reads the header of a binary 8 bit PGM (P5), PPM (P6) or PAM (P7) image into the description of a direct image,
+// leaving the reader at the first sample. PAM images have 1 to 4 channels, gray, gray and alpha, RGB or RGBA,
+// which stb_image can't decode. Returns false for any other image, which is left to stb_image.
+bool readPNMHeader(struct PNMReader *reader, struct DirectImage *image)
+{
+	char magic = readPNMCharacter(reader);
+	char type = readPNMCharacter(reader);
+	if (magic != 'P' || (type != '5' && type != '6' && type != '7'))
+	{
+		return false;
+	}
+
+	int width;
+	int height;
+	int channels;
+	int maxValue;
+	if (type == '7')
+	{
+		if (!readPAMHeader(reader, &width, &height, &channels, &maxValue) || channels > 4)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// The header is read the same way as stb_image reads it, so the samples start at the same place.
+		char c = readPNMCharacter(reader);
+		skipPNMSpace(reader, &c);
+		width = readPNMInteger(reader, &c);
+		skipPNMSpace(reader, &c);
+		height = readPNMInteger(reader, &c);
+		skipPNMSpace(reader, &c);
+		maxValue = readPNMInteger(reader, &c);
+		channels = type == '6' ? 3 : 1;
+	}
+
+	// Samples above 255 take 2 bytes, which are reduced by the 16 bit path. stb_image doesn't scale samples with a
+	// smaller maximum, so neither is done here.
+	if (width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255)
+	{
+		return false;
+	}
+
+	image->base = NULL;
+	image->pitch = (ptrdiff_t)width * channels;
+	image->width = width;
+	image->height = height;
+	image->format = channels >= 3 ? findPixelFormat(channels == 3 ? "rgb" : "rgba") : NULL;
+	image->channels = channels;
+	image->headerChannels = channels == 1 ? 3 : 4;
+	return true;
+}
+
+// Reads a binary 8 bit PGM, PPM or PAM image in place, where the samples follow the header in order.
+// Returns false for any other image, or one that is cut short, which are left to stb_image.
+bool readPNMImage(unsigned char *file, size_t size, struct DirectImage *image)
+{
+	if (size < 3 || file[0] != 'P')
+	{
+		return false;
+	}
+
+	struct PNMReader reader = {file, size, NULL, 0};
+	if (!readPNMHeader(&reader, image) || size - reader.position < (size_t)image->pitch * image->height)
+	{
+		return false;
+	}
+	image->base = file + reader.position;
+	return true;
+}
+
+// Reads a file of pixels with no header, in the size and pixel format from the options, in place.
+// Returns false if the file is too small for that size.
+bool readRawImage(unsigned char *file, size_t size, struct Options *options, struct DirectImage *image)
+{
+	const struct PixelFormat *format = options->pixelFormat;
+	size_t stride = (size_t)options->rawWidth * format->size;
+	if (size < stride * options->rawHeight)
+	{
+		return false;
+	}
+
+	image->base = file;
+	image->pitch = (ptrdiff_t)stride;
+	image->width = options->rawWidth;
+	image->height = options->rawHeight;
+	image->format = format;
+	image->channels = 4;
+	image->headerChannels = 4;
+	return true;
+}
+
+// Reads a file as an uncompressed image in place if it is one, or as raw pixels if the options give their size.
+bool readDirectImage(unsigned char *file, size_t size, struct Options *options, struct DirectImage *image)
+{
+	if (options->rawWidth != 0)
+	{
+		return readRawImage(file, size, options, image);
+	}
+	return readBMPImage(file, size, image) || readPNMImage(file, size, image) || readTGAImage(file, size, image);
+}
+
+// Encodes an uncompressed image straight from the file, reordering the bytes of its pixels as they are encoded.
+// A crop and a flip are applied to the walk over its rows, so nothing is copied and only the rows that are
+// encoded are read.
+void convertDirectToQOI(struct DirectImage *image, struct OutputImage *outputImage, struct Options *options)
+{
+	unsigned char *base = image->base;
+	ptrdiff_t pitch = image->pitch;
+	if (options->flip)
+	{
+		flipRows(&base, &pitch, image->height);
+	}
+
+	struct InputImage dimensions = {0};
+	dimensions.width = image->width;
+	dimensions.height = image->height;
+	struct Rectangle region;
+	getCropRegion(&dimensions, options, &region);
+
+	struct EncoderState state;
+	startQOI(&state, outputImage, region.width, region.height, image->headerChannels, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	int kernel = getBestKernel();
+	int pixelSize = image->format != NULL ? image->format->size : image->channels;
+	for (int y = 0; y < region.height; y++)
+	{
+		unsigned char *row = base + (region.y + y) * pitch + (ptrdiff_t)region.x * pixelSize;
+		if (image->format != NULL)
+		{
+			encodeFormattedRow(&state, kernel, image->format, row, region.width);
+		}
+		else
+		{
+			encodeSampleRow(&state, row, image->channels, region.width);
+		}
+		flushQOI(&state);
+	}
+
+	finishQOI(&state, outputImage);
+}
+
+// Copies an uncompressed image into an input image, with color pixels reordered into RGBA, for conversions
+// that need the whole image such as resizing.
+void importDirectImage(struct DirectImage *image, struct InputImage *inputImage)
+{
+	inputImage->width = image->width;
+	inputImage->height = image->height;
+	inputImage->fileLocation = NULL;
+	inputImage->samples16 = NULL;
+	inputImage->samplesHDR = NULL;
+	inputImage->channels = image->format != NULL ? 4 : image->channels;
+	inputImage->orientation = 1;
+	inputImage->pixels = NULL;
+	inputImage->samples = NULL;
+
+	if (image->format != NULL)
+	{
+		int kernel = getBestKernel();
+		inputImage->pixels = malloc(sizeof(struct Pixel) * image->width * image->height);
+		for (int y = 0; y < image->height; y++)
+		{
+			swizzlePixels(kernel, image->format, image->base + y * image->pitch, image->width, inputImage->pixels + (size_t)y * image->width);
+		}
+		return;
+	}
+
+	size_t rowLength = (size_t)image->width * image->channels;
+	inputImage->samples = malloc(rowLength * image->height);
+	for (int y = 0; y < image->height; y++)
+	{
+		memcpy(inputImage->samples + y * rowLength, image->base + y * image->pitch, rowLength);
+	}
+}
+
+// The most bytes of rows read from a stream at a time. Large enough that each read is worthwhile, small enough that
+// an image of any size is converted in a few megabytes.
+#define STREAM_BATCH_SIZE (4 << 20)
+
+// Reads what a streamed source is, either raw pixels of the size in the options or a PNM image from its header,
+// leaving the stream at the first pixel. The rows of the image are read after this, so the base of it is NULL.
+// Returns false for anything else.
+bool readStreamHeader(FILE *source, struct Options *options, struct DirectImage *image)
+{
+	if (options->rawWidth != 0)
+	{
+		image->base = NULL;
+		image->pitch = (ptrdiff_t)options->rawWidth * options->pixelFormat->size;
+		image->width = options->rawWidth;
+		image->height = options->rawHeight;
+		image->format = options->pixelFormat;
+		image->channels = 4;
+		image->headerChannels = 4;
+		return true;
+	}
+
+	struct PNMReader reader = {NULL, 0, source, 0};
+	return readPNMHeader(&reader, image);
+}
+
+// Encodes an uncompressed image as it is read from a stream, a batch of rows at a time, so the image never has to
+// fit in memory. Only the rows of a crop are read. A flipped image is read a batch at a time from the bottom up,
+// which needs a source that can be seeked, so it can't be read from a pipe.
+// Returns false if the stream ends before the image does, or the crop starts outside the image.
+bool convertStreamToQOI(FILE *source, struct DirectImage *image, struct OutputImage *outputImage, struct Options *options)
+{
+	size_t rowSize = (size_t)image->pitch;
+	int pixelSize = image->format != NULL ? image->format->size : image->channels;
+	off_t start = ftello(source);
+	if (options->flip && start < 0)
+	{
+		return false;
+	}
+
+	struct InputImage dimensions = {0};
+	dimensions.width = image->width;
+	dimensions.height = image->height;
+	if (!cropStartsInImage(&dimensions, options))
+	{
+		return false;
+	}
+	struct Rectangle region;
+	getCropRegion(&dimensions, options, &region);
+
+	int batchRows = rowSize < STREAM_BATCH_SIZE ? (int)(STREAM_BATCH_SIZE / rowSize) : 1;
+	batchRows = batchRows < region.height ? batchRows : region.height;
+	unsigned char *batch = malloc(rowSize * batchRows);
+
+	// Rows above the crop are skipped, by seeking past them when the source can be seeked and reading them otherwise.
+	bool complete = true;
+	if (!options->flip && region.y > 0 && (start < 0 || fseeko(source, start + (off_t)region.y * rowSize, SEEK_SET) != 0))
+	{
+		for (int y = 0; y < region.y && complete; y += batchRows)
+		{
+			size_t count = region.y - y < batchRows ? region.y - y : batchRows;
+			complete = fread(batch, rowSize, count, source) == count;
+		}
+	}
+
+	struct EncoderState state;
+	startQOI(&state, outputImage, region.width, region.height, image->headerChannels, 0x00);
+	state.alphaTransform = options->alphaTransform;
+
+	int kernel = getBestKernel();
+	for (int y = 0; y < region.height && complete; y += batchRows)
+	{
+		int count = region.height - y < batchRows ? region.height - y : batchRows;
+
+		// The rows of a flipped batch are the rows above the batch before it, read in the order they are stored
+		// and walked from the last one back.
+		unsigned char *base = batch;
+		ptrdiff_t pitch = (ptrdiff_t)rowSize;
+		if (options->flip)
+		{
+			int firstRow = image->height - region.y - y - count;
+			if (fseeko(source, start + (off_t)firstRow * rowSize, SEEK_SET) != 0)
+			{
+				complete = false;
+				break;
+			}
+			flipRows(&base, &pitch, count);
+		}
+		if (fread(batch, rowSize, count, source) != (size_t)count)
+		{
+			complete = false;
+			break;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			unsigned char *row = base + i * pitch + (ptrdiff_t)region.x * pixelSize;
+			if (image->format != NULL)
+			{
+				encodeFormattedRow(&state, kernel, image->format, row, region.width);
+			}
+			else
+			{
+				encodeSampleRow(&state, row, image->channels, region.width);
+			}
+			flushQOI(&state);
+		}
+	}
+
+	finishQOI(&state, outputImage);
+	free(batch);
+	return complete;
+}
+
+// Converts an image file that has been read into memory, taking the fused PNG path when it can.
+// The fused path encodes rows as they are unfiltered, so it isn't used for images that are resized, cropped or
+// flipped. Uncompressed images and raw pixels are encoded straight from the file, and are only copied to be resized.
+// Returns false if the file can't be decoded, or the crop starts outside the image.
+bool convertFileToQOI(unsigned char *file, size_t size, struct OutputImage *outputImage, struct Options *options)
+{
+	bool resizing = options->resizeWidth != 0 || options->resizeHeight != 0;
+	if (options->rawWidth == 0 && !resizing && options->crop.width == 0 && !options->flip && convertPNGToQOI(file, size, outputImage, options))
+	{
+		return true;
+	}
+
+	struct DirectImage directImage;
+	if (readDirectImage(file, size, options, &directImage))
+	{
+		struct InputImage dimensions = {0};
+		dimensions.width = directImage.width;
+		dimensions.height = directImage.height;
+		if (!cropStartsInImage(&dimensions, options))
+		{
+			return false;
+		}
+		if (!resizing)
+		{
+			convertDirectToQOI(&directImage, outputImage, options);
+			return true;
+		}
+		struct InputImage inputImage;
+		importDirectImage(&directImage, &inputImage);
+		convertToQOI(&inputImage, outputImage, options);
+		freeInputImage(&inputImage);
+		return true;
+	}
+	if (options->rawWidth != 0)
+	{
+		return false;
+	}
+
+	struct InputImage inputImage;
+	if (!importImageFromMemory(file, size, &inputImage, options->targetSize) || !cropStartsInImage(&inputImage, options))
+	{
+		freeInputImage(&inputImage);
+		return false;
+	}
+	convertToQOI(&inputImage, outputImage, options);
+	freeInputImage(&inputImage);
+	return true;
+}
+
+// Maps a file into memory to be read in place, so it isn't copied into a buffer first. Uncompressed images are
+// then encoded straight from the page cache. Returns NULL if the file can't be mapped, such as when it is empty or
+// a pipe, or on Windows, in which case it can still be read with readFile.
+unsigned char *mapFile(char *fileLocation, size_t *size)
+{
+#ifdef _WIN32
+	return NULL;
+#else
+	int descriptor = open(fileLocation, O_RDONLY);
+	if (descriptor < 0)
+	{
+		return NULL;
+	}
+	struct stat fileStatus;
+	if (fstat(descriptor, &fileStatus) != 0 || !S_ISREG(fileStatus.st_mode) || fileStatus.st_size == 0)
+	{
+		close(descriptor);
+		return NULL;
+	}
+
+	*size = fileStatus.st_size;
+	void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	close(descriptor);
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+	// Images are read from start to end, so the kernel can read ahead of the encoder.
+	madvise(data, *size, MADV_SEQUENTIAL);
+	return data;
+#endif
+}
+
+void unmapFile(unsigned char *data, size_t size)
+{
+#ifndef _WIN32
+	munmap(data, size);
+#endif
+}
+
+// Converts the image at the file location, or from stdin if the location is "-".
+// Returns false if the image can't be read or decoded, or the crop starts outside it.
+bool convertImageToQOI(char *fileLocation, struct OutputImage *outputImage, struct Options *options)
+{
+	// Raw pixels and PNM images can be read a batch of rows at a time, which is always done for raw pixels
+	// from stdin as stb_image can't decode them. Other images, and resized ones, are read the usual way.
+	bool standardStream = isStandardStream(fileLocation);
+	bool resizing = options->resizeWidth != 0 || options->resizeHeight != 0;
+	if ((options->stream || (standardStream && options->rawWidth != 0)) && !resizing)
+	{
+		FILE *source = stdin;
+		if (standardStream)
+		{
+			setBinaryMode(stdin);
+		}
+		else
+		{
+			source = fopen(fileLocation, "rb");
+			if (source == NULL)
+			{
+				return false;
+			}
+		}
+
+		// A PNM header starts with P, which is put back for the other formats.
+		int first = getc(source);
+		ungetc(first, source);
+		struct DirectImage image;
+		if ((options->rawWidth != 0 || first == 'P') && readStreamHeader(source, options, &image))
+		{
+			bool converted = convertStreamToQOI(source, &image, outputImage, options);
+			if (!standardStream)
+			{
+				fclose(source);
+			}
+			return converted;
+		}
+		if (!standardStream)
+		{
+			fclose(source);
+		}
+		else if (options->rawWidth != 0 || first == 'P')
+		{
+			// The header has been read from stdin, so it can't be decoded another way.
+			return false;
+		}
+	}
+
+	// stdin is decoded as it arrives instead of being read into memory first.
+	if (standardStream)
+	{
+		struct InputImage inputImage;
+		bool imported = importImage(fileLocation, &inputImage, options->targetSize) && cropStartsInImage(&inputImage, options);
+		if (imported)
+		{
+			convertToQOI(&inputImage, outputImage, options);
+		}
+		freeInputImage(&inputImage);
+		return imported;
+	}
+
+	size_t size;
+	unsigned char *file = mapFile(fileLocation, &size);
+	bool mapped = file != NULL;
+	if (!mapped)
+	{
+		file = readFile(fileLocation, &size);
+	}
+	if (file == NULL)
+	{
+		return false;
+	}
+	bool converted = convertFileToQOI(file, size, outputImage, options);
+	if (mapped)
+	{
+		unmapFile(file, size);
+	}
+	else
+	{
+		free(file);
+	}
+	return converted;
+}
+
+// Gets the number of processors, used as the default number of threads.
+int getProcessorCount()
+{
+#ifdef _WIN32
+	return 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? count : 1;
+#endif
+}
+
+// Runs the work function on the given number of threads and waits for all of them to finish.
+// Every thread is given the same job, which holds everything needed to pick the next piece of work.
+void runOnThreads(void *(*work)(void *), void *job, int threadCount)
+{
+#ifdef _WIN32
+	work(job);
+#else
+	pthread_t *threads = malloc(sizeof(pthread_t) * threadCount);
+
+	// If a thread can't be created, the ones that were carry on without it.
+	// If none could be, the work is done on this thread instead.
+	int startedCount = 0;
+	for (int i = 0; i < threadCount; i++)
+	{
+		if (pthread_create(&threads[startedCount], NULL, work, job) == 0)
+		{
+			startedCount++;
+		}
+	}
+	if (startedCount == 0)
+	{
+		work(job);
+	}
+	for (int i = 0; i < startedCount; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+#endif
+}
+
+// Creates the location of a numbered file by adding the number, written with the number format, before the extension.
+// Ex. "out/anim.qoi", "%04d", 3 => "out/anim_0003.qoi"
+char *createNumberedLocation(char *location, const char *numberFormat, int number)
+{
+	char numberText[16];
+	snprintf(numberText, sizeof(numberText), numberFormat, number);
+
+	// The extension starts at the last dot, as long as that dot is after the last folder separator.
+	char *extension = strrchr(location, '.');
+	char *folder = strrchr(location, '/');
+	if (extension == NULL || (folder != NULL && extension < folder))
+	{
+		extension = location + strlen(location);
+	}
+
+	int nameLength = extension - location;
+	int length = snprintf(NULL, 0, "%.*s_%s%s", nameLength, location, numberText, extension);
+	char *numberedLocation = malloc(length + 1);
+	sprintf(numberedLocation, "%.*s_%s%s", nameLength, location, numberText, extension);
+	return numberedLocation;
+}
+
+// Everything the threads need to encode the frames of a GIF.
+struct FrameJob
+{
+	// All the frames one after another, each width * height RGBA pixels.
+	unsigned char *frames;
+	int width;
+	int height;
+	int frameCount;
+	char *exportLocation;
+	struct Options *options;
+	// The next frame that hasn't been picked up by a thread yet.
+	atomic_int nextFrame;
+	// Only used with the delta option. The rectangles of each frame that changed from the frame before.
+	struct Rectangle **changedRectangles;
+	int *changedRectangleCounts;
+};
+
+// The size of the square tiles that frames are compared in for the delta option.
+// Small enough that a small change doesn't cause much of the frame to be saved again,
+// large enough that most frames don't end up with many tiny files.
+#define DELTA_TILE_SIZE 16
+
+// Finds the rectangles of a frame that are different to the frame before it.
+// The frame is compared in tiles. Rows that are the same in both frames are skipped with a single memcmp
+// (which uses SIMD in the C library) and only the tiles of rows that are different are compared.
+// Changed tiles that are next to each other in a row of tiles are joined into one rectangle, and rectangles
+// that line up exactly with a rectangle in the row of tiles above are joined to it.
+// Returns the number of rectangles, which are saved to the rectangles array (allocated here).
+int findChangedRectangles(struct Pixel *frame, struct Pixel *previousFrame, int width, int height, struct Rectangle **rectangles)
+{
+	int tileColumns = (width + DELTA_TILE_SIZE - 1) / DELTA_TILE_SIZE;
+	bool *changedTiles = malloc(sizeof(bool) * tileColumns);
+
+	int count = 0;
+	int capacity = 16;
+	*rectangles = malloc(sizeof(struct Rectangle) * capacity);
+	// The rectangles that end at the bottom of the previous row of tiles, which may be extended downwards.
+	int firstOpenRectangle = 0;
+
+	for (int tileY = 0; tileY < height; tileY += DELTA_TILE_SIZE)
+	{
+		int tileHeight = tileY + DELTA_TILE_SIZE <= height ? DELTA_TILE_SIZE : height - tileY;
+		memset(changedTiles, 0, sizeof(bool) * tileColumns);
+
+		for (int y = tileY; y < tileY + tileHeight; y++)
+		{
+			struct Pixel *row = frame + y * width;
+			struct Pixel *previousRow = previousFrame + y * width;
+
+			// Whole row is the same, so none of its tiles changed.
+			if (memcmp(row, previousRow, sizeof(struct Pixel) * width) == 0)
+			{
+				continue;
+			}
+
+			for (int column = 0; column < tileColumns; column++)
+			{
+				if (changedTiles[column])
+				{
+					continue;
+				}
+				int x = column * DELTA_TILE_SIZE;
+				int tileWidth = x + DELTA_TILE_SIZE <= width ? DELTA_TILE_SIZE : width - x;
+				changedTiles[column] = memcmp(row + x, previousRow + x, sizeof(struct Pixel) * tileWidth) != 0;
+			}
+		}
+
+		int openRectangleEnd = count;
+
+		// Join the changed tiles in this row of tiles into rectangles.
+		for (int column = 0; column < tileColumns; column++)
+		{
+			if (!changedTiles[column])
+			{
+				continue;
+			}
+
+			int lastColumn = column;
+			while (lastColumn + 1 < tileColumns && changedTiles[lastColumn + 1])
+			{
+				lastColumn++;
+			}
+
+			struct Rectangle rectangle;
+			rectangle.x = column * DELTA_TILE_SIZE;
+			rectangle.y = tileY;
+			rectangle.width = (lastColumn + 1) * DELTA_TILE_SIZE <= width ? (lastColumn + 1 - column) * DELTA_TILE_SIZE : width - rectangle.x;
+			rectangle.height = tileHeight;
+			column = lastColumn;
+
+			// Extend a rectangle from the row of tiles above if it covers exactly the same columns.
+			bool extended = false;
+			for (int i = firstOpenRectangle; i < openRectangleEnd; i++)
+			{
+				if ((*rectangles)[i].x == rectangle.x && (*rectangles)[i].width == rectangle.width)
+				{
+					(*rectangles)[i].height += tileHeight;
+					extended = true;
+					break;
+				}
+			}
+			if (extended)
+			{
+				continue;
+			}
+
+			if (count == capacity)
+			{
+				capacity *= 2;
+				*rectangles = realloc(*rectangles, sizeof(struct Rectangle) * capacity);
+			}
+			(*rectangles)[count] = rectangle;
+			count++;
+		}
+
+		// Only rectangles that reach the bottom of this row of tiles can be extended by the next one.
+		// Rectangles are kept in order, so move the ones that reach it to the end of the list.
+		int keptEnd = count;
+		int writeIndex = firstOpenRectangle;
+		struct Rectangle *reaching = malloc(sizeof(struct Rectangle) * (keptEnd - firstOpenRectangle + 1));
+		int reachingCount = 0;
+		for (int i = firstOpenRectangle; i < keptEnd; i++)
+		{
+			if ((*rectangles)[i].y + (*rectangles)[i].height == tileY + tileHeight)
+			{
+				reaching[reachingCount] = (*rectangles)[i];
+				reachingCount++;
+			}
+			else
+			{
+				(*rectangles)[writeIndex] = (*rectangles)[i];
+				writeIndex++;
+			}
+		}
+		memcpy(*rectangles + writeIndex, reaching, sizeof(struct Rectangle) * reachingCount);
+		free(reaching);
+		firstOpenRectangle = writeIndex;
+	}
+
+	free(changedTiles);
+	return count;
+}
+
+// Thread function that keeps taking the next frame and encoding it until there are none left.
+// Every QOI file is independent, so the frames can be encoded in any order.
+void *encodeFrames(void *job)
+{
+	struct FrameJob *frameJob = job;
+
+	while (true)
+	{
+		int frame = atomic_fetch_add(&frameJob->nextFrame, 1);
+		if (frame >= frameJob->frameCount)
+		{
+			break;
+		}
+
+		// The frame is encoded straight from the decoded GIF. Each pixel is 4 bytes (r,g,b,a),
+		// which is the same layout as a Pixel, so no copy is needed.
+		struct Pixel *pixels = (struct Pixel *)(frameJob->frames + (size_t)frame * frameJob->width * frameJob->height * 4);
+
+		// With the delta option, only the parts of the frame that changed are saved, each as its own image.
+		// The first frame has nothing before it, so it is saved as one rectangle covering the whole frame.
+		if (frameJob->options->delta)
+		{
+			struct Rectangle **rectangles = &frameJob->changedRectangles[frame];
+			int count;
+			if (frame == 0)
+			{
+				*rectangles = malloc(sizeof(struct Rectangle));
+				(*rectangles)[0].x = 0;
+				(*rectangles)[0].y = 0;
+				(*rectangles)[0].width = frameJob->width;
+				(*rectangles)[0].height = frameJob->height;
+				count = 1;
+			}
+			else
+			{
+				struct Pixel *previousPixels = pixels - frameJob->width * frameJob->height;
+				count = findChangedRectangles(pixels, previousPixels, frameJob->width, frameJob->height, rectangles);
+			}
+			frameJob->changedRectangleCounts[frame] = count;
+
+			// A flipped frame is read from the bottom up, and its rectangles are moved to where they are in the flipped frame.
+			unsigned char *base = (unsigned char *)pixels;
+			ptrdiff_t pitch = (ptrdiff_t)frameJob->width * 4;
+			if (frameJob->options->flip)
+			{
+				flipRows(&base, &pitch, frameJob->height);
+				for (int i = 0; i < count; i++)
+				{
+					(*rectangles)[i].y = frameJob->height - (*rectangles)[i].y - (*rectangles)[i].height;
+				}
+			}
+
+			char *frameLocation = createNumberedLocation(frameJob->exportLocation, "%04d", frame);
+			for (int i = 0; i < count; i++)
+			{
+				struct OutputImage outputImage = {0};
+				convertRegionToQOI(base, pitch, 4, &(*rectangles)[i], &outputImage, frameJob->options);
+
+				char *rectangleLocation = createNumberedLocation(frameLocation, "%04d", i);
+				if (!exportQOI(rectangleLocation, &outputImage))
+				{
+					fprintf(stderr, "%s could not be written.\n", rectangleLocation);
+				}
+
+				free(rectangleLocation);
+				free(outputImage.data);
+			}
+			free(frameLocation);
+			continue;
+		}
+
+		struct InputImage inputImage;
+		inputImage.width = frameJob->width;
+		inputImage.height = frameJob->height;
+		inputImage.fileLocation = NULL;
+		inputImage.pixels = pixels;
+		inputImage.samples = NULL;
+		inputImage.samples16 = NULL;
+		inputImage.samplesHDR = NULL;
+		inputImage.channels = 4;
+		inputImage.orientation = 1;
+
+		struct OutputImage outputImage = {0};
+		convertToQOI(&inputImage, &outputImage, frameJob->options);
+
+		char *frameLocation = createNumberedLocation(frameJob->exportLocation, "%04d", frame);
+		if (!exportQOI(frameLocation, &outputImage))
+		{
+			fprintf(stderr, "%s could not be written.\n", frameLocation);
+		}
+
+		free(frameLocation);
+		free(outputImage.data);
+	}
+
+	return NULL;
+}
+
+// Saves the index of a delta encoded sequence to <destination>.txt.
+// The index lists every frame with its delay in milliseconds followed by the rectangles that changed in that frame
+// and the files they were saved to. To play the sequence, each rectangle is drawn over the previous frame.
+// Ex.
+//		sequence 97 61 12
+//		frame 0 50
+//		0 0 97 61 anim_0000_0000.qoi
+//		frame 1 60
+//		0 0 16 16 anim_0001_0000.qoi
+// Returns false if the index could not be written.
+bool saveDeltaIndex(struct FrameJob *job, int *delays)
+{
+	char *indexLocation = malloc(strlen(job->exportLocation) + sizeof(".txt"));
+	sprintf(indexLocation, "%s.txt", job->exportLocation);
+	FILE *f = fopen(indexLocation, "w");
+	free(indexLocation);
+	if (f == NULL)
+	{
+		return false;
+	}
+
+	fprintf(f, "sequence %d %d %d\n", job->width, job->height, job->frameCount);
+	for (int frame = 0; frame < job->frameCount; frame++)
+	{
+		fprintf(f, "frame %d %d\n", frame, delays != NULL ? delays[frame] : 0);
+
+		char *frameLocation = createNumberedLocation(job->exportLocation, "%04d", frame);
+		for (int i = 0; i < job->changedRectangleCounts[frame]; i++)
+		{
+			struct Rectangle *rectangle = &job->changedRectangles[frame][i];
+			char *rectangleLocation = createNumberedLocation(frameLocation, "%04d", i);
+
+			// Only the file name is saved, as the files are in the same folder as the index.
+			char *fileName = strrchr(rectangleLocation, '/');
+			fprintf(f, "%d %d %d %d %s\n", rectangle->x, rectangle->y, rectangle->width, rectangle->height, fileName != NULL ? fileName + 1 : rectangleLocation);
+			free(rectangleLocation);
+		}
+		free(frameLocation);
+	}
+
+	return fclose(f) == 0;
+}
+
+// Decodes every frame of an animated GIF and saves each one to a numbered QOI file,
+// with the frames spread over the threads.
+void convertGIFFrames(char *importLocation, char *exportLocation, struct Options *options)
+{
+	size_t size;
+	unsigned char *file = readFile(importLocation, &size);
+
+	// Every GIF starts with "GIF8".
+	if (file == NULL || size < 4 || memcmp(file, "GIF8", 4) != 0)
+	{
+		fprintf(stderr, "Source file is not a GIF.\n");
+		free(file);
+		return;
+	}
+
+	struct FrameJob job;
+	int *delays;
+	int channels;
+	// stb_image decodes all the frames into one array with 4 channels per pixel.
+	job.frames = stbi_load_gif_from_memory(file, size, &delays, &job.width, &job.height, &job.frameCount, &channels, 4);
+	free(file);
+
+	if (job.frames == NULL)
+	{
+		fprintf(stderr, "Source file could not be decoded.\n");
+		return;
+	}
+
+	// Delta frames are saved as the rectangles that changed, so only whole frames are cropped.
+	struct InputImage dimensions = {0};
+	dimensions.width = job.width;
+	dimensions.height = job.height;
+	if (!options->delta && !cropStartsInImage(&dimensions, options))
+	{
+		fprintf(stderr, "Crop starts outside the image.\n");
+		stbi_image_free(job.frames);
+		stbi_image_free(delays);
+		return;
+	}
+
+	job.exportLocation = exportLocation;
+	job.options = options;
+	atomic_init(&job.nextFrame, 0);
+	job.changedRectangles = malloc(sizeof(struct Rectangle *) * job.frameCount);
+	job.changedRectangleCounts = malloc(sizeof(int) * job.frameCount);
+
+	// There is no point having more threads than frames.
+	runOnThreads(encodeFrames, &job, options->threadCount < job.frameCount ? options->threadCount : job.frameCount);
+
+	if (options->delta)
+	{
+		if (!saveDeltaIndex(&job, delays))
+		{
+			fprintf(stderr, "Delta index could not be written.\n");
+		}
+		for (int i = 0; i < job.frameCount; i++)
+		{
+			free(job.changedRectangles[i]);
+		}
+	}
+
+	printf("Saved %d frames.\n", job.frameCount);
+
+	free(job.changedRectangles);
+	free(job.changedRectangleCounts);
+
+	stbi_image_free(job.frames);
+	stbi_image_free(delays);
+}
+
+// Everything the threads need to encode the sizes of an image.
+struct SizeJob
+{
+	// The image at each size, largest first. Sizes that are the same as the size before share its image.
+	struct InputImage **levels;
+	// The width each level was asked for, which is used for its file name.
+	int *widths;
+	int levelCount;
+	char *exportLocation;
+	// Levels that are the source image itself are encoded with its crop, and resized levels are already cropped.
+	struct InputImage *source;
+	struct Options *sourceOptions;
+	struct Options *options;
+	// Set for a high dynamic range image saved as linear. Its resized levels are 8 bit copies, so the colorspace
+	// is written back into their header.
+	bool linear;
+	// The next level that hasn't been picked up by a thread yet.
+	atomic_int nextLevel;
+};
+
+void *encodeSizes(void *job)
+{
+	struct SizeJob *sizeJob = job;
+
+	while (true)
+	{
+		int level = atomic_fetch_add(&sizeJob->nextLevel, 1);
+		if (level >= sizeJob->levelCount)
+		{
+			break;
+		}
+
+		struct OutputImage outputImage = {0};
+		struct InputImage *levelImage = sizeJob->levels[level];
+		convertToQOI(levelImage, &outputImage, levelImage == sizeJob->source ? sizeJob->sourceOptions : sizeJob->options);
+		if (sizeJob->linear)
+		{
+			outputImage.data[13] = 0x01;
+		}
+
+		// Each size is saved to <location>_<width> with the same extension.
+		char *sizedLocation = createNumberedLocation(sizeJob->exportLocation, "%d", sizeJob->widths[level]);
+		if (!exportQOI(sizedLocation, &outputImage))
+		{
+			fprintf(stderr, "%s could not be written.\n", sizedLocation);
+		}
+
+		free(sizedLocation);
+		free(outputImage.data);
+	}
+
+	return NULL;
+}
+
+int compareWidthsDescending(const void *a, const void *b)
+{
+	return *(const int *)b - *(const int *)a;
+}
+
+// Saves an image at each of the widths in the options from a single decode, keeping its aspect ratio.
+// The sizes are made largest first, each resized from the one before it like a mip chain, so every resize
+// only reads an image a little larger than the one it makes instead of the full size image. The sizes
+// are then encoded at the same time on their own threads.
+void convertImageSizes(char *importLocation, char *exportLocation, struct Options *options)
+{
+	struct InputImage inputImage;
+	if (!importImage(importLocation, &inputImage, options->targetSize))
+	{
+		fprintf(stderr, "Source file could not be decoded.\n");
+		freeInputImage(&inputImage);
+		return;
+	}
+	if (!cropStartsInImage(&inputImage, options))
+	{
+		fprintf(stderr, "Crop starts outside the image.\n");
+		freeInputImage(&inputImage);
+		return;
+	}
+
+	int levelCount = options->outputWidthCount;
+	int *widths = malloc(sizeof(int) * levelCount);
+	memcpy(widths, options->outputWidths, sizeof(int) * levelCount);
+	qsort(widths, levelCount, sizeof(int), compareWidthsDescending);
+
+	// A cropped image is sized from its crop, which only the first resize reads from the source image.
+	struct Rectangle cropRegion;
+	getCropRegion(&inputImage, options, &cropRegion);
+
+	// Images aren't made larger, so widths beyond the image use the image as it is.
+	struct InputImage **levels = malloc(sizeof(struct InputImage *) * levelCount);
+	struct InputImage *resizedImages = malloc(sizeof(struct InputImage) * levelCount);
+	int resizedCount = 0;
+	struct InputImage *previous = &inputImage;
+	struct Rectangle region = cropRegion;
+
+	// The levels are already the right size, so they are encoded without resizing them again. Only the source image
+	// is cropped and flipped, so levels resized from the levels before them aren't.
+	struct Options sourceOptions = *options;
+	sourceOptions.resizeWidth = 0;
+	sourceOptions.resizeHeight = 0;
+	struct Options levelOptions = sourceOptions;
+	levelOptions.crop.width = 0;
+	levelOptions.flip = false;
+
+	for (int i = 0; i < levelCount; i++)
+	{
+		if (widths[i] >= region.width)
+		{
+			levels[i] = previous;
+			continue;
+		}
+		// The height comes from the full size image, so rounding doesn't build up down the chain.
+		int height = (int)((double)cropRegion.height * widths[i] / cropRegion.width + 0.5);
+		height = height < 1 ? 1 : height;
+		resizeImage(previous, &region, &resizedImages[resizedCount], widths[i], height, previous == &inputImage ? options : &levelOptions);
+		previous = &resizedImages[resizedCount];
+		levels[i] = previous;
+		resizedCount++;
+		region.x = 0;
+		region.y = 0;
+		region.width = widths[i];
+		region.height = height;
+	}
+
+	struct SizeJob job;
+	job.levels = levels;
+	job.widths = widths;
+	job.levelCount = levelCount;
+	job.exportLocation = exportLocation;
+	job.source = &inputImage;
+	job.sourceOptions = &sourceOptions;
+	job.options = &levelOptions;
+	job.linear = inputImage.samplesHDR != NULL && options->linear;
+	atomic_init(&job.nextLevel, 0);
+
+	// There is no point having more threads than sizes.
+	runOnThreads(encodeSizes, &job, options->threadCount < levelCount ? options->threadCount : levelCount);
+
+	printf("Saved %d sizes.\n", levelCount);
+
+	for (int i = 0; i < resizedCount; i++)
+	{
+		freeInputImage(&resizedImages[i]);
+	}
+	free(resizedImages);
+	free(levels);
+	free(widths);
+	freeInputImage(&inputImage);
+}
+
+
+// Constants for hashBytes. The primes are the ones used by xxHash, and the keys are arbitrary 64 bit values.
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_32 0x9E3779B1U
+const unsigned long long hashKeys[4] = {0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL};
+
+// Mixes the bits of a 64 bit value so that every input bit affects every output bit.
+unsigned long long mixHash(unsigned long long hash)
+{
+	hash ^= hash >> 33;
+	hash *= HASH_PRIME_2;
+	hash ^= hash >> 29;
+	hash *= HASH_PRIME_1;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+// Fast non-cryptographic 64 bit hash of an array of bytes, used to tell if files have changed.
+// The bytes are read in stripes of 32 bytes into 4 independent 64 bit accumulators (the same structure as XXH3),
+// so the SSE2 version can work on 2 accumulators per register and the processor never waits on a previous stripe.
+// For each 8 bytes: the bytes xor the lane's key are split into 2 halves that are multiplied together and added
+// to the lane, and the bytes themselves are added to the neighbouring lane. Every 32 stripes the accumulators
+// are scrambled so that bytes far apart in the file still mix together.
+// The result depends on the byte order of the processor, which is fine as hashes are only compared on the same machine.
+unsigned long long hashBytes(const unsigned char *bytes, size_t size)
+{
+	unsigned long long accumulators[4] = {HASH_PRIME_1, HASH_PRIME_2, ~HASH_PRIME_1, ~HASH_PRIME_2};
+	size_t stripeCount = size / 32;
+	size_t stripe = 0;
+
+#ifdef __SSE2__
+	__m128i accumulator0 = _mm_loadu_si128((__m128i *)accumulators);
+	__m128i accumulator1 = _mm_loadu_si128((__m128i *)(accumulators + 2));
+	const __m128i key0 = _mm_loadu_si128((__m128i *)hashKeys);
+	const __m128i key1 = _mm_loadu_si128((__m128i *)(hashKeys + 2));
+	const __m128i prime = _mm_set1_epi32(HASH_PRIME_32);
+
+	for (; stripe < stripeCount; stripe++)
+	{
+		__m128i data0 = _mm_loadu_si128((__m128i *)(bytes + stripe * 32));
+		__m128i data1 = _mm_loadu_si128((__m128i *)(bytes + stripe * 32 + 16));
+
+		// _mm_mul_epu32 multiplies the low 32 bits of each 64 bit lane, so shifting the high half down
+		// gives low * high for both lanes.
+		__m128i keyed0 = _mm_xor_si128(data0, key0);
+		__m128i keyed1 = _mm_xor_si128(data1, key1);
+		__m128i product0 = _mm_mul_epu32(keyed0, _mm_srli_epi64(keyed0, 32));
+		__m128i product1 = _mm_mul_epu32(keyed1, _mm_srli_epi64(keyed1, 32));
+
+		// Swap the 2 lanes of the data so each is added to its neighbour.
+		__m128i swapped0 = _mm_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2));
+		__m128i swapped1 = _mm_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2));
+
+		accumulator0 = _mm_add_epi64(accumulator0, _mm_add_epi64(product0, swapped0));
+		accumulator1 = _mm_add_epi64(accumulator1, _mm_add_epi64(product1, swapped1));
+
+		if (stripe % 32 == 31)
+		{
+			// accumulator = (accumulator ^ (accumulator >> 47) ^ key) * prime
+			// The 64 bit multiply is built from 2 32 bit multiplies, as SSE2 doesn't have one.
+			accumulator0 = _mm_xor_si128(_mm_xor_si128(accumulator0, _mm_srli_epi64(accumulator0, 47)), key0);
+			accumulator1 = _mm_xor_si128(_mm_xor_si128(accumulator1, _mm_srli_epi64(accumulator1, 47)), key1);
+			accumulator0 = _mm_add_epi64(_mm_mul_epu32(accumulator0, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(accumulator0, 32), prime), 32));
+			accumulator1 = _mm_add_epi64(_mm_mul_epu32(accumulator1, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(accumulator1, 32), prime), 32));
+		}
+	}
+
+	_mm_storeu_si128((__m128i *)accumulators, accumulator0);
+	_mm_storeu_si128((__m128i *)(accumulators + 2), accumulator1);
+#endif
+
+	// Plain C version of the same calculation.
+	for (; stripe < stripeCount; stripe++)
+	{
+		for (int lane = 0; lane < 4; lane++)
+		{
+			unsigned long long data;
+			memcpy(&data, bytes + stripe * 32 + lane * 8, 8);
+			unsigned long long keyed = data ^ hashKeys[lane];
+			accumulators[lane] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+			accumulators[lane ^ 1] += data;
+		}
+
+		if (stripe % 32 == 31)
+		{
+			for (int lane = 0; lane < 4; lane++)
+			{
+				accumulators[lane] = (accumulators[lane] ^ (accumulators[lane] >> 47) ^ hashKeys[lane]) * HASH_PRIME_32;
+			}
+		}
+	}
+
+	// Combine the accumulators, the size and the bytes left over after the last full stripe.
+	unsigned long long hash = size * HASH_PRIME_1;
+	for (int lane = 0; lane < 4; lane++)
+	{
+		hash = (hash ^ mixHash(accumulators[lane])) * HASH_PRIME_2;
+	}
+	for (size_t i = stripeCount * 32; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * HASH_PRIME_1;
+	}
+
+	return mixHash(hash);
+}
+
+#ifndef _WIN32
+// The version of the encoder, saved in the batch manifest. This must be increased whenever a change
+// to the encoder changes the files it saves, so that batch conversions encode every file again.
+#define ENCODER_VERSION 1
+
+// The name of the manifest file saved in the destination folder of a batch conversion.
+#define MANIFEST_NAME ".encodeQOI-manifest"
+
+// The most characters written by writeConversionOptions, with the null character.
+#define CONVERSION_OPTIONS_LENGTH 160
+
+// Writes every option that changes the QOI an image is converted to as text, with the values separated by dots.
+// The batch manifest saves it so files are converted again when one changes, and clients of the daemon send it
+// with each request so the daemon converts with their options.
+void writeConversionOptions(struct Options *options, char *text, size_t size)
+{
+	snprintf(text, size, "%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%s", options->downConversion, options->tonemap, options->linear,
+		options->alphaTransform, options->targetSize, options->resizeWidth, options->resizeHeight, options->resizeFilter, options->crop.x,
+		options->crop.y, options->crop.width, options->crop.height, options->flip, options->ignoreOrientation, options->rawWidth,
+		options->rawHeight, options->pixelFormat->name);
+}
+
+// Reads options written by writeConversionOptions, keeping the other options as they are.
+// The values are checked the same way readArgs checks them. Returns false, leaving the options unchanged, if they aren't valid.
+bool readConversionOptions(char *text, struct Options *options)
+{
+	struct Options read = *options;
+	int downConversion, tonemap, linear, alphaTransform, resizeFilter, flip, ignoreOrientation;
+	char pixelFormat[16];
+	int length = 0;
+	if (sscanf(text, "%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%d.%15[a-z]%n", &downConversion, &tonemap, &linear, &alphaTransform,
+			&read.targetSize, &read.resizeWidth, &read.resizeHeight, &resizeFilter, &read.crop.x, &read.crop.y, &read.crop.width,
+			&read.crop.height, &flip, &ignoreOrientation, &read.rawWidth, &read.rawHeight, pixelFormat, &length) != 17 ||
+		text[length] != '\0')
+	{
+		return false;
+	}
+
+	read.pixelFormat = findPixelFormat(pixelFormat);
+	bool noCrop = read.crop.x == 0 && read.crop.y == 0 && read.crop.width == 0 && read.crop.height == 0;
+	bool validCrop = read.crop.x >= 0 && read.crop.y >= 0 && read.crop.width > 0 && read.crop.height > 0;
+	bool noRaw = read.rawWidth == 0 && read.rawHeight == 0;
+	bool validRaw = read.rawWidth > 0 && read.rawHeight > 0 && read.rawWidth <= STBI_MAX_DIMENSIONS && read.rawHeight <= STBI_MAX_DIMENSIONS;
+	if (downConversion < DOWN_CONVERSION_TRUNCATE || downConversion > DOWN_CONVERSION_DITHER || tonemap < TONEMAP_CLAMP || tonemap > TONEMAP_ACES ||
+		linear < 0 || linear > 1 || alphaTransform < ALPHA_KEEP || alphaTransform > ALPHA_UNPREMULTIPLY || read.targetSize < 0 ||
+		read.resizeWidth < 0 || read.resizeHeight < 0 || resizeFilter < RESIZE_BOX || resizeFilter > RESIZE_BILINEAR || (!noCrop && !validCrop) ||
+		flip < 0 || flip > 1 || ignoreOrientation < 0 || ignoreOrientation > 1 || (!noRaw && !validRaw) || read.pixelFormat == NULL)
+	{
+		return false;
+	}
+
+	read.downConversion = downConversion;
+	read.tonemap = tonemap;
+	read.linear = linear;
+	read.alphaTransform = alphaTransform;
+	read.resizeFilter = resizeFilter;
+	read.flip = flip;
+	read.ignoreOrientation = ignoreOrientation;
+	*options = read;
+	return true;
+}
+
+// A file found in the source folder of a batch conversion.
+struct BatchFile
+{
+	char *sourceLocation;
+	// Location within the source folder, which is the same as the location of the QOI within the destination folder
+	// (apart from the extension).
+	char *relativeLocation;
+	char *exportLocation;
+	long long size;
+	long long modified;
+};
+
+// What the manifest records about each converted file, so it doesn't have to be converted again.
+struct ManifestEntry
+{
+	char *relativeLocation;
+	long long size;
+	long long modified;
+	unsigned long long sourceHash;
+	// The encoder version and the options that change the output, so a file is converted again if either changes.
+	char version[192];
+	unsigned long long outputHash;
+};
+
+// A list that grows as items are added to it.
+struct BatchFileList
+{
+	struct BatchFile *files;
+	int count;
+	int capacity;
+};
+
+// Everything the threads need to convert the files of a batch.
+struct BatchJob
+{
+	struct BatchFile *files;
+	int fileCount;
+	// The entries loaded from the manifest, sorted by location so they can be searched.
+	struct ManifestEntry *previousEntries;
+	int previousEntryCount;
+	// The new entry for each file. Entries with a NULL location are for files that failed to convert.
+	struct ManifestEntry *entries;
+	char version[192];
+	struct Options *options;
+	// Whether each file has to be converted, rather than being unchanged since the last conversion.
+	bool *needsConversion;
+	// The hash of each file's source. Only set for files that were read.
+	unsigned long long *sourceHashes;
+	// The index of the first file with the same source as each file, or -1 if it is the first.
+	int *duplicateOf;
+	// The processor time it took to convert each file.
+	double *encodeSeconds;
+	atomic_int nextFile;
+	atomic_int convertedCount;
+	atomic_int skippedCount;
+	atomic_int failedCount;
+};
+
+// Determines if a file has the extension of an image type stb_image can decode.
+bool isImageFile(char *name)
+{
+	const char *extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".ppm", ".pgm", ".pnm", ".pam"};
+
+	char *extension = strrchr(name, '.');
+	if (extension == NULL)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+	{
+		if (strcasecmp(extension, extensions[i]) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Creates a string from a format, allocating exactly the space it needs.
+char *createString(const char *format, const char *first, const char *second)
+{
+	int length = snprintf(NULL, 0, format, first, second);
+	char *result = malloc(length + 1);
+	sprintf(result, format, first, second);
+	return result;
+}
+
+// Adds every image in the folder, and the folders within it, to the list.
+// Relative folder is the location of the folder within the source folder ("" for the source folder itself).
+void findImageFiles(char *sourceFolder, char *relativeFolder, char *exportFolder, struct BatchFileList *list)
+{
+	char *folderLocation = createString("%s%s", sourceFolder, relativeFolder);
+	DIR *folder = opendir(folderLocation);
+	free(folderLocation);
+	if (folder == NULL)
+	{
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(folder)) != NULL)
+	{
+		// Skip hidden files (including the manifest if the destination is within the source) and the . and .. folders.
+		if (entry->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		char *relativeLocation = createString("%s/%s", relativeFolder, entry->d_name);
+		char *sourceLocation = createString("%s%s", sourceFolder, relativeLocation);
+
+		struct stat status;
+		if (stat(sourceLocation, &status) != 0)
+		{
+			free(relativeLocation);
+			free(sourceLocation);
+			continue;
+		}
+
+		if (S_ISDIR(status.st_mode))
+		{
+			findImageFiles(sourceFolder, relativeLocation, exportFolder, list);
+			free(relativeLocation);
+			free(sourceLocation);
+			continue;
+		}
+
+		if (!isImageFile(entry->d_name))
+		{
+			free(relativeLocation);
+			free(sourceLocation);
+			continue;
+		}
+
+		if (list->count == list->capacity)
+		{
+			list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+			list->files = realloc(list->files, sizeof(struct BatchFile) * list->capacity);
+		}
+
+		struct BatchFile *file = &list->files[list->count];
+		list->count++;
+
+		file->sourceLocation = sourceLocation;
+		// The relative location is saved without the / at the start.
+		file->relativeLocation = strdup(relativeLocation + 1);
+		file->size = status.st_size;
+		file->modified = status.st_mtime;
+
+		// The export location is the same location within the destination folder, with the extension changed to .qoi
+		char *extension = strrchr(relativeLocation, '.');
+		*extension = '\0';
+		file->exportLocation = createString("%s%s.qoi", exportFolder, relativeLocation);
+
+		free(relativeLocation);
+	}
+
+	closedir(folder);
+}
+
+// Compares manifest entries by their location, for sorting and searching.
+int compareManifestEntries(const void *a, const void *b)
+{
+	return strcmp(((struct ManifestEntry *)a)->relativeLocation, ((struct ManifestEntry *)b)->relativeLocation);
+}
+
+// Loads the manifest in the export folder. Returns the number of entries, which are sorted by location.
+// A missing or unreadable manifest has no entries.
+int loadManifest(char *exportFolder, struct ManifestEntry **entries)
+{
+	*entries = NULL;
+
+	char *manifestLocation = createString("%s/%s", exportFolder, MANIFEST_NAME);
+	FILE *f = fopen(manifestLocation, "r");
+	free(manifestLocation);
+	if (f == NULL)
+	{
+		return 0;
+	}
+
+	int count = 0;
+	int capacity = 0;
+	// Each line is: size modified sourceHash version outputHash location
+	// The location is last as it may contain spaces.
+	char line[4200];
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		struct ManifestEntry entry;
+		char location[4097];
+		if (sscanf(line, "%lld %lld %llx %191s %llx %4096[^\n]", &entry.size, &entry.modified, &entry.sourceHash, entry.version, &entry.outputHash, location) != 6)
+		{
+			continue;
+		}
+
+		if (count == capacity)
+		{
+			capacity = capacity == 0 ? 64 : capacity * 2;
+			*entries = realloc(*entries, sizeof(struct ManifestEntry) * capacity);
+		}
+		entry.relativeLocation = strdup(location);
+		(*entries)[count] = entry;
+		count++;
+	}
+	fclose(f);
+
+	qsort(*entries, count, sizeof(struct ManifestEntry), compareManifestEntries);
+	return count;
+}
+
+// Saves the entries to the manifest in the export folder.
+// The manifest is written to a temporary file first and then renamed, so an interrupted batch
+// can't leave a manifest that is only partly written.
+void saveManifest(char *exportFolder, struct ManifestEntry *entries, int count)
+{
+	char *manifestLocation = createString("%s/%s", exportFolder, MANIFEST_NAME);
+	char *temporaryLocation = createString("%s/%s.tmp", exportFolder, MANIFEST_NAME);
+
+	FILE *f = fopen(temporaryLocation, "w");
+	if (f != NULL)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (entries[i].relativeLocation == NULL)
+			{
+				continue;
+			}
+			fprintf(f, "%lld %lld %016llx %s %016llx %s\n", entries[i].size, entries[i].modified, entries[i].sourceHash, entries[i].version, entries[i].outputHash, entries[i].relativeLocation);
+		}
+		fclose(f);
+		rename(temporaryLocation, manifestLocation);
+	}
+
+	free(temporaryLocation);
+	free(manifestLocation);
+}
+
+// Creates every folder in a file location that doesn't exist yet.
+void createFolders(char *fileLocation)
+{
+	char *location = strdup(fileLocation);
+
+	// Temporarily end the string at each separator to create the folder up to it.
+	for (char *separator = strchr(location + 1, '/'); separator != NULL; separator = strchr(separator + 1, '/'))
+	{
+		*separator = '\0';
+		mkdir(location, 0777);
+		*separator = '/';
+	}
+
+	free(location);
+}
+
+// Determines if the QOI at the location still has the hash it was saved with.
+bool outputMatchesHash(char *exportLocation, unsigned long long outputHash)
+{
+	size_t size;
+	unsigned char *output = readFile(exportLocation, &size);
+	if (output == NULL)
+	{
+		return false;
+	}
+	bool matches = hashBytes(output, size) == outputHash;
+	free(output);
+	return matches;
+}
+
+// Gets the processor time used by the calling thread in seconds, used to measure the time saved by deduplication.
+double getThreadSeconds()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Thread function that checks each file of the batch against the manifest.
+// Files that are unchanged get their previous entry. Every other file has its source hashed, which is used both to
+// catch files that were only touched and to find files with the same contents before any of them are decoded.
+void *checkBatchFiles(void *job)
+{
+	struct BatchJob *batchJob = job;
+
+	while (true)
+	{
+		int index = atomic_fetch_add(&batchJob->nextFile, 1);
+		if (index >= batchJob->fileCount)
+		{
+			break;
+		}
+
+		struct BatchFile *file = &batchJob->files[index];
+		struct ManifestEntry *entry = &batchJob->entries[index];
+		batchJob->needsConversion[index] = false;
+
+		// Find what the manifest recorded the last time this file was converted.
+		struct ManifestEntry key;
+		key.relativeLocation = file->relativeLocation;
+		// There are no entries to search before the first conversion into a folder.
+		struct ManifestEntry *previous = NULL;
+		if (batchJob->previousEntryCount > 0)
+		{
+			previous = bsearch(&key, batchJob->previousEntries, batchJob->previousEntryCount, sizeof(struct ManifestEntry), compareManifestEntries);
+		}
+
+		// Only a previous conversion with the same encoder and options can be reused, and only if its QOI still exists.
+		bool reusable = previous != NULL && strcmp(previous->version, batchJob->version) == 0 && access(file->exportLocation, F_OK) == 0;
+
+		// If the size and modified time haven't changed, the file is assumed to be the same without reading it.
+		if (reusable && !batchJob->options->verify && previous->size == file->size && previous->modified == file->modified)
+		{
+			*entry = *previous;
+			entry->relativeLocation = strdup(file->relativeLocation);
+			// The hash from the manifest lets changed files with the same contents use this file's QOI.
+			batchJob->sourceHashes[index] = previous->sourceHash;
+			atomic_fetch_add(&batchJob->skippedCount, 1);
+			continue;
+		}
+
+		size_t size;
+		unsigned char *source = readFile(file->sourceLocation, &size);
+		if (source == NULL)
+		{
+			entry->relativeLocation = NULL;
+			atomic_fetch_add(&batchJob->failedCount, 1);
+			continue;
+		}
+		batchJob->sourceHashes[index] = hashBytes(source, size);
+		free(source);
+
+		// The file was touched or verification was asked for, but the contents are the same as before.
+		// With verification, the QOI must also still be the file that was saved.
+		if (reusable && previous->sourceHash == batchJob->sourceHashes[index] && (!batchJob->options->verify || outputMatchesHash(file->exportLocation, previous->outputHash)))
+		{
+			*entry = *previous;
+			entry->relativeLocation = strdup(file->relativeLocation);
+			entry->size = file->size;
+			entry->modified = file->modified;
+			atomic_fetch_add(&batchJob->skippedCount, 1);
+			continue;
+		}
+
+		batchJob->needsConversion[index] = true;
+	}
+
+	return NULL;
+}
+
+// Decodes, converts and saves one file of the batch and fills in its manifest entry.
+// Returns false if the file couldn't be read, decoded or saved.
+bool convertBatchFile(struct BatchJob *batchJob, int index)
+{
+	struct BatchFile *file = &batchJob->files[index];
+	struct ManifestEntry *entry = &batchJob->entries[index];
+	double start = getThreadSeconds();
+
+	entry->relativeLocation = NULL;
+
+	size_t size;
+	unsigned char *source = readFile(file->sourceLocation, &size);
+	if (source == NULL)
+	{
+		return false;
+	}
+
+	struct OutputImage outputImage = {0};
+	bool converted = convertFileToQOI(source, size, &outputImage, batchJob->options);
+	free(source);
+	if (!converted)
+	{
+		free(outputImage.data);
+		return false;
+	}
+
+	createFolders(file->exportLocation);
+	// The previous QOI may be a hard link shared with duplicate files, so it is removed rather than
+	// overwritten, which would change the QOI of the duplicates too.
+	unlink(file->exportLocation);
+	// Without the file, there is no output for the manifest to record.
+	if (!exportQOI(file->exportLocation, &outputImage))
+	{
+		free(outputImage.data);
+		return false;
+	}
+
+	entry->relativeLocation = strdup(file->relativeLocation);
+	entry->size = file->size;
+	entry->modified = file->modified;
+	entry->sourceHash = batchJob->sourceHashes[index];
+	strcpy(entry->version, batchJob->version);
+	entry->outputHash = hashBytes((unsigned char *)outputImage.data, outputImage.dataSize);
+
+	free(outputImage.data);
+
+	batchJob->encodeSeconds[index] = getThreadSeconds() - start;
+	return true;
+}
+
+// Thread function that keeps taking the next file of the batch and converting it until there are none left.
+// Files with the same contents as an earlier file are left for linkDuplicateFiles.
+void *convertBatchFiles(void *job)
+{
+	struct BatchJob *batchJob = job;
+
+	while (true)
+	{
+		int index = atomic_fetch_add(&batchJob->nextFile, 1);
+		if (index >= batchJob->fileCount)
+		{
+			break;
+		}
+
+		if (!batchJob->needsConversion[index] || batchJob->duplicateOf[index] != -1)
+		{
+			continue;
+		}
+
+		if (convertBatchFile(batchJob, index))
+		{
+			atomic_fetch_add(&batchJob->convertedCount, 1);
+		}
+		else
+		{
+			atomic_fetch_add(&batchJob->failedCount, 1);
+		}
+	}
+
+	return NULL;
+}
+
+// The batch job being sorted by compareSourceHashes. qsort doesn't pass any context to the comparison.
+struct BatchJob *sortingBatchJob;
+
+// Compares 2 files of the batch by the hash and size of their source. Files with the same source are ordered
+// so that files that already have a QOI come first, then by their index.
+int compareSourceHashes(const void *a, const void *b)
+{
+	int first = *(int *)a;
+	int second = *(int *)b;
+	unsigned long long firstHash = sortingBatchJob->sourceHashes[first];
+	unsigned long long secondHash = sortingBatchJob->sourceHashes[second];
+
+	if (firstHash != secondHash)
+	{
+		return firstHash < secondHash ? -1 : 1;
+	}
+	if (sortingBatchJob->files[first].size != sortingBatchJob->files[second].size)
+	{
+		return sortingBatchJob->files[first].size < sortingBatchJob->files[second].size ? -1 : 1;
+	}
+	if (sortingBatchJob->needsConversion[first] != sortingBatchJob->needsConversion[second])
+	{
+		return sortingBatchJob->needsConversion[first] ? 1 : -1;
+	}
+	return first - second;
+}
+
+// Finds the files that need converting with the same source hash and size as another file.
+// Each of those is marked as a duplicate of the first file with that source, which is the only one converted.
+// Unchanged files are included using the hash from the manifest, so a new copy of an unchanged file uses its existing QOI.
+void findDuplicateFiles(struct BatchJob *batchJob)
+{
+	int *order = malloc(sizeof(int) * (batchJob->fileCount + 1));
+	int count = 0;
+
+	for (int i = 0; i < batchJob->fileCount; i++)
+	{
+		batchJob->duplicateOf[i] = -1;
+		// Files that failed have no hash.
+		if (batchJob->needsConversion[i] || batchJob->entries[i].relativeLocation != NULL)
+		{
+			order[count] = i;
+			count++;
+		}
+	}
+
+	// Sorting puts files with the same source next to each other.
+	sortingBatchJob = batchJob;
+	qsort(order, count, sizeof(int), compareSourceHashes);
+
+	int first = count > 0 ? order[0] : -1;
+	for (int i = 1; i < count; i++)
+	{
+		int file = order[i];
+		if (batchJob->sourceHashes[file] != batchJob->sourceHashes[first] || batchJob->files[file].size != batchJob->files[first].size)
+		{
+			// Start of a new source.
+			first = file;
+		}
+		else if (batchJob->needsConversion[file])
+		{
+			batchJob->duplicateOf[file] = first;
+		}
+	}
+
+	free(order);
+}
+
+// Determines if 2 files have exactly the same contents.
+bool filesMatch(char *firstLocation, char *secondLocation)
+{
+	size_t firstSize, secondSize;
+	unsigned char *first = readFile(firstLocation, &firstSize);
+	unsigned char *second = readFile(secondLocation, &secondSize);
+
+	bool match = first != NULL && second != NULL && firstSize == secondSize && memcmp(first, second, firstSize) == 0;
+
+	free(first);
+	free(second);
+	return match;
+}
+
+// Makes the file at the destination location have the same contents as the source file.
+// A hard link is used where possible so the contents are only stored once. If the locations are on
+// different file systems (where hard links can't be made), the file is copied instead.
+bool linkOrCopyFile(char *sourceLocation, char *destinationLocation)
+{
+	// Hard links can't replace an existing file.
+	unlink(destinationLocation);
+	if (link(sourceLocation, destinationLocation) == 0)
+	{
+		return true;
+	}
+
+	size_t size;
+	unsigned char *data = readFile(sourceLocation, &size);
+	if (data == NULL)
+	{
+		return false;
+	}
+
+	FILE *f = fopen(destinationLocation, "wb");
+	bool copied = f != NULL && fwrite(data, 1, size, f) == size;
+	if (f != NULL)
+	{
+		fclose(f);
+	}
+	free(data);
+	return copied;
+}
+
+// Gives every duplicate file the QOI of the first file with the same source, instead of encoding it again.
+// The sources are compared byte by byte first, so the rare files that only share a hash are still converted.
+void linkDuplicateFiles(struct BatchJob *batchJob)
+{
+	int linkedCount = 0;
+	long long savedBytes = 0;
+	double savedSeconds = 0;
+
+	for (int i = 0; i < batchJob->fileCount; i++)
+	{
+		int first = batchJob->duplicateOf[i];
+		if (first == -1)
+		{
+			continue;
+		}
+
+		struct BatchFile *file = &batchJob->files[i];
+		struct ManifestEntry *firstEntry = &batchJob->entries[first];
+
+		// The first file failed to convert, so its duplicate would too.
+		if (firstEntry->relativeLocation == NULL)
+		{
+			batchJob->entries[i].relativeLocation = NULL;
+			batchJob->failedCount++;
+			continue;
+		}
+
+		createFolders(file->exportLocation);
+		if (filesMatch(batchJob->files[first].sourceLocation, file->sourceLocation) && linkOrCopyFile(batchJob->files[first].exportLocation, file->exportLocation))
+		{
+			batchJob->entries[i] = *firstEntry;
+			batchJob->entries[i].relativeLocation = strdup(file->relativeLocation);
+			batchJob->entries[i].size = file->size;
+			batchJob->entries[i].modified = file->modified;
+
+			struct stat status;
+			if (stat(file->exportLocation, &status) == 0)
+			{
+				savedBytes += status.st_size;
+			}
+			// A first file left unchanged since the last run wasn't encoded now, so it adds no time.
+			savedSeconds += batchJob->encodeSeconds[first];
+			linkedCount++;
+		}
+		else if (convertBatchFile(batchJob, i))
+		{
+			batchJob->convertedCount++;
+		}
+		else
+		{
+			batchJob->failedCount++;
+		}
+	}
+
+	if (linkedCount > 0)
+	{
+		printf("Deduplicated %d files, saving %lld bytes of output and %.3f s of encoding (of files encoded in this run).\n", linkedCount, savedBytes, savedSeconds);
+	}
+}
+
+// Converts every image in the source folder (and the folders within it) to a QOI at the same location within the
+// destination folder. A manifest of what was converted is kept in the destination folder, so files that haven't
+// changed since the last conversion are skipped after only checking their size and modified time.
+// Files that have the same contents are only encoded once, with the others linked to the same QOI.
+void convertFolder(char *importFolder, char *exportFolder, struct Options *options)
+{
+	struct BatchFileList list;
+	list.files = NULL;
+	list.count = 0;
+	list.capacity = 0;
+	findImageFiles(importFolder, "", exportFolder, &list);
+
+	struct BatchJob job;
+	job.files = list.files;
+	job.fileCount = list.count;
+	job.previousEntryCount = loadManifest(exportFolder, &job.previousEntries);
+	job.entries = calloc(list.count, sizeof(struct ManifestEntry));
+	job.options = options;
+	char conversionOptions[CONVERSION_OPTIONS_LENGTH];
+	writeConversionOptions(options, conversionOptions, sizeof(conversionOptions));
+	snprintf(job.version, sizeof(job.version), "%d.%s", ENCODER_VERSION, conversionOptions);
+	atomic_init(&job.nextFile, 0);
+	atomic_init(&job.convertedCount, 0);
+	atomic_init(&job.skippedCount, 0);
+	atomic_init(&job.failedCount, 0);
+
+	mkdir(exportFolder, 0777);
+
+	job.needsConversion = malloc(sizeof(bool) * list.count);
+	job.sourceHashes = malloc(sizeof(unsigned long long) * list.count);
+	job.duplicateOf = malloc(sizeof(int) * list.count);
+	job.encodeSeconds = calloc(list.count, sizeof(double));
+
+	if (list.count > 0)
+	{
+		int threadCount = options->threadCount < list.count ? options->threadCount : list.count;
+
+		// First find which files changed and hash them, then convert the first file with each source,
+		// and finally link the duplicates to the QOI of the first.
+		runOnThreads(checkBatchFiles, &job, threadCount);
+		findDuplicateFiles(&job);
+		atomic_store(&job.nextFile, 0);
+		runOnThreads(convertBatchFiles, &job, threadCount);
+		linkDuplicateFiles(&job);
+	}
+
+	// The manifest only lists the files that exist now, so entries for deleted files are dropped.
+	saveManifest(exportFolder, job.entries, list.count);
+
+	printf("Converted %d, skipped %d unchanged, %d failed.\n", atomic_load(&job.convertedCount), atomic_load(&job.skippedCount), atomic_load(&job.failedCount));
+
+	for (int i = 0; i < list.count; i++)
+	{
+		free(list.files[i].sourceLocation);
+		free(list.files[i].relativeLocation);
+		free(list.files[i].exportLocation);
+		free(job.entries[i].relativeLocation);
+	}
+	for (int i = 0; i < job.previousEntryCount; i++)
+	{
+		free(job.previousEntries[i].relativeLocation);
+	}
+	free(list.files);
+	free(job.entries);
+	free(job.previousEntries);
+	free(job.needsConversion);
+	free(job.sourceHashes);
+	free(job.duplicateOf);
+	free(job.encodeSeconds);
+}
+#endif
+
+// Gets the current time in seconds, used for timing benchmarks.
+double getSeconds()
+{
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Times inflating the image data of a PNG with inflateZlib against stb_image's zlib decoder, and checks they agree.
+// Speeds are in MB of inflated data per second. Does nothing for other images.
+void benchmarkInflate(char *importLocation, struct Options *options)
+{
+	size_t size;
+	unsigned char *file = readFile(importLocation, &size);
+	struct PNGHeader header;
+	if (file == NULL || !readPNGHeader(file, size, &header))
+	{
+		if (file != NULL && header.dataAllocated)
+		{
+			free(header.data);
+		}
+		free(file);
+		return;
+	}
+
+	size_t inflatedSize = 0;
+	unsigned char *inflated = NULL;
+	double start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		free(inflated);
+		inflated = inflateZlib(header.data, header.dataSize, header.dataSize * 4, &inflatedSize);
+	}
+	double inflateSeconds = getSeconds() - start;
+
+	int stbSize = 0;
+	char *stbInflated = NULL;
+	start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		free(stbInflated);
+		stbInflated = stbi_zlib_decode_malloc_guesssize_headerflag((char *)header.data, header.dataSize, header.dataSize * 4, &stbSize, 1);
+	}
+	double stbSeconds = getSeconds() - start;
+
+	double megabytes = (double)inflatedSize * options->benchmarkIterations / 1e6;
+	printf("Inflate:\t%.1f MB/s\n", megabytes / inflateSeconds);
+	printf("stb_image inflate:\t%.1f MB/s\n", megabytes / stbSeconds);
+	if (inflated == NULL || stbInflated == NULL || inflatedSize != (size_t)stbSize || memcmp(inflated, stbInflated, inflatedSize) != 0)
+	{
+		printf("The inflated data is different from stb_image's.\n");
+	}
+
+	free(inflated);
+	free(stbInflated);
+	if (header.dataAllocated)
+	{
+		free(header.data);
+	}
+	free(file);
+}
+
+// Times each PNG filter with each unfilter kernel the processor supports, on the rows of the image,
+// and checks every kernel gives the same result as the plain C version. Speeds are in MB of rows per second.
+// Does nothing for other images.
+void benchmarkUnfilter(char *importLocation, struct Options *options)
+{
+	size_t size;
+	unsigned char *file = readFile(importLocation, &size);
+	struct PNGHeader header;
+	if (file == NULL || !readPNGHeader(file, size, &header))
+	{
+		if (file != NULL && header.dataAllocated)
+		{
+			free(header.data);
+		}
+		free(file);
+		return;
+	}
+	int rowLength = (header.width * header.channels * header.depth + 7) / 8;
+	int pixelSize = header.channels * header.depth / 8 > 0 ? header.channels * header.depth / 8 : 1;
+	size_t imageSize = (size_t)rowLength * header.height;
+
+	// The filtered rows of the image itself are used, without their filter bytes, so the values are realistic.
+	size_t inflatedSize;
+	unsigned char *inflated = inflateZlib(header.data, header.dataSize, imageSize + header.height, &inflatedSize);
+	if (header.dataAllocated)
+	{
+		free(header.data);
+	}
+	free(file);
+	if (inflated == NULL || inflatedSize < imageSize + header.height)
+	{
+		free(inflated);
+		return;
+	}
+
+	unsigned char *source = malloc(imageSize);
+	unsigned char *expected = malloc(imageSize);
+	unsigned char *rows = malloc(imageSize);
+	for (unsigned int y = 0; y < header.height; y++)
+	{
+		memcpy(source + (size_t)y * rowLength, inflated + (size_t)y * (rowLength + 1) + 1, rowLength);
+	}
+	free(inflated);
+
+	const char *filterNames[] = {"", "sub", "up", "average", "paeth"};
+	const char *kernelNames[] = {"plain C", "SSE2", "AVX2"};
+	for (int filter = PNG_FILTER_SUB; filter <= PNG_FILTER_PAETH; filter++)
+	{
+		printf("Unfilter %s:", filterNames[filter]);
+		for (int kernel = KERNEL_PLAIN; kernel <= getBestKernel(); kernel++)
+		{
+			// Every iteration unfilters the same rows again, which doesn't change how long it takes.
+			memcpy(rows, source, imageSize);
+			double start = getSeconds();
+			for (int i = 0; i < options->benchmarkIterations; i++)
+			{
+				for (unsigned int y = 0; y < header.height; y++)
+				{
+					unsigned char *row = rows + (size_t)y * rowLength;
+					unfilterPNGRowWith(kernel, filter, row, y == 0 ? NULL : row - rowLength, rowLength, pixelSize);
+				}
+			}
+			double seconds = getSeconds() - start;
+			printf("\t%s %.1f MB/s", kernelNames[kernel], (double)imageSize * options->benchmarkIterations / 1e6 / seconds);
+
+			// Unfilter the rows once more from the start to compare them.
+			memcpy(rows, source, imageSize);
+			for (unsigned int y = 0; y < header.height; y++)
+			{
+				unsigned char *row = rows + (size_t)y * rowLength;
+				unfilterPNGRowWith(kernel, filter, row, y == 0 ? NULL : row - rowLength, rowLength, pixelSize);
+			}
+			if (kernel == KERNEL_PLAIN)
+			{
+				memcpy(expected, rows, imageSize);
+			}
+			else if (memcmp(expected, rows, imageSize) != 0)
+			{
+				printf(" (different from plain C)");
+			}
+		}
+		printf("\n");
+	}
+
+	free(source);
+	free(expected);
+	free(rows);
+}
+
+// Times decoding a JPEG with stb_image's SSE2 kernels against the AVX2 kernels, and checks they give the same pixels.
+// Does nothing for other images, or if the processor doesn't support AVX2.
+void benchmarkJPEG(char *importLocation, struct Options *options)
+{
+	if (getBestKernel() != KERNEL_AVX2)
+	{
+		return;
+	}
+
+	size_t size;
+	unsigned char *file = readFile(importLocation, &size);
+	if (file == NULL)
+	{
+		return;
+	}
+
+	stbi__context context;
+	int width, height, channels;
+	stbi__start_mem(&context, file, (int)size);
+	if (!stbi__jpeg_info(&context, &width, &height, &channels))
+	{
+		free(file);
+		return;
+	}
+
+	unsigned char *decoded[2] = {NULL, NULL};
+	double seconds[2];
+	int kernels[2] = {KERNEL_SSE2, KERNEL_AVX2};
+	for (int k = 0; k < 2; k++)
+	{
+		double start = getSeconds();
+		for (int i = 0; i < options->benchmarkIterations; i++)
+		{
+			stbi_image_free(decoded[k]);
+			stbi__start_mem(&context, file, (int)size);
+			decoded[k] = decodeJPEG(&context, kernels[k], channels, &width, &height);
+		}
+		seconds[k] = getSeconds() - start;
+	}
+
+	printf("JPEG SSE2 decode:\t%.3f ms per image\n", seconds[0] * 1000 / options->benchmarkIterations);
+	printf("JPEG AVX2 decode:\t%.3f ms per image\n", seconds[1] * 1000 / options->benchmarkIterations);
+	size_t decodedSize = (size_t)width * height * (channels == 3 ? 4 : 1);
+	if (decoded[0] == NULL || decoded[1] == NULL || memcmp(decoded[0], decoded[1], decodedSize) != 0)
+	{
+		printf("The AVX2 kernels decode different pixels from the SSE2 kernels.\n");
+	}
+
+	stbi_image_free(decoded[0]);
+	stbi_image_free(decoded[1]);
+	free(file);
+}
+
+// Times importing and converting an image the way this program does it against
+// loading it as 8 bits with stb_image (which does its own 16 bit and HDR conversion) and encoding the result.
+void benchmarkConversion(char *importLocation, struct Options *options)
+{
+	// The same output image is used for every conversion, so its data array is only allocated once.
+	struct OutputImage outputImage = {0};
+
+	double start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		if (!convertImageToQOI(importLocation, &outputImage, options))
+		{
+			free(outputImage.data);
+			return;
+		}
+	}
+	double converted = getSeconds() - start;
+
+	// Some sources, such as PAM images and raw pixels, are decoded by Encode QOI but not by stb_image.
+	bool stbDecoded = true;
+	start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		int x, y, n;
+		unsigned char *data = stbi_load(importLocation, &x, &y, &n, 0);
+		if (data == NULL)
+		{
+			stbDecoded = false;
+			break;
+		}
+
+		struct EncoderState state;
+		startQOI(&state, &outputImage, x, y, n == 2 || n == 4 ? 4 : 3, 0x00);
+		encodeSampleRow(&state, data, n, x * y);
+		finishQOI(&state, &outputImage);
+
+		stbi_image_free(data);
+	}
+	double stbConverted = getSeconds() - start;
+
+	free(outputImage.data);
+
+	printf("Encode QOI:\t%.3f ms per image\n", converted * 1000 / options->benchmarkIterations);
+	if (stbDecoded)
+	{
+		printf("stb_image 8 bit:\t%.3f ms per image\n", stbConverted * 1000 / options->benchmarkIterations);
+	}
+	else
+	{
+		printf("stb_image 8 bit:\tcan't decode this image\n");
+	}
+
+	benchmarkInflate(importLocation, options);
+	benchmarkUnfilter(importLocation, options);
+	benchmarkJPEG(importLocation, options);
+}
+
+#ifndef _WIN32
+// Times encoding every image in a folder one at a time against encoding them in groups with convertImagesToQOI.
+// The images are decoded once beforehand and everything runs on one thread, so only the encoders are compared.
+void benchmarkFolderConversion(char *importFolder, char *exportFolder, struct Options *options)
+{
+	struct BatchFileList list;
+	list.files = NULL;
+	list.count = 0;
+	list.capacity = 0;
+	findImageFiles(importFolder, "", exportFolder, &list);
+
+	struct InputImage *inputImages = malloc(sizeof(struct InputImage) * list.count);
+	struct OutputImage *outputImages = calloc(list.count, sizeof(struct OutputImage));
+	int imageCount = 0;
+	long long pixelCount = 0;
+	for (int i = 0; i < list.count; i++)
+	{
+		if (importImage(list.files[i].sourceLocation, &inputImages[imageCount], 0))
+		{
+			pixelCount += inputImages[imageCount].width * inputImages[imageCount].height;
+			imageCount++;
+		}
+		else
+		{
+			freeInputImage(&inputImages[imageCount]);
+		}
+	}
+
+	double start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		for (int image = 0; image < imageCount; image++)
+		{
+			convertToQOI(&inputImages[image], &outputImages[image], options);
+		}
+	}
+	double separate = getSeconds() - start;
+
+	// Both encoders must give the same files.
+	unsigned long long *hashes = malloc(sizeof(unsigned long long) * imageCount);
+	for (int image = 0; image < imageCount; image++)
+	{
+		hashes[image] = hashBytes((unsigned char *)outputImages[image].data, outputImages[image].dataSize);
+	}
+
+	start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		convertImagesToQOI(inputImages, outputImages, imageCount, options);
+	}
+	double interleaved = getSeconds() - start;
+
+	int mismatchCount = 0;
+	for (int image = 0; image < imageCount; image++)
+	{
+		if (hashBytes((unsigned char *)outputImages[image].data, outputImages[image].dataSize) != hashes[image])
+		{
+			mismatchCount++;
+		}
+	}
+
+	double conversions = (double)options->benchmarkIterations * imageCount;
+	printf("%d images, %.0f pixels on average.\n", imageCount, imageCount > 0 ? (double)pixelCount / imageCount : 0.0);
+	printf("One at a time:\t%.3f us per image\n", separate * 1e6 / conversions);
+	printf("Interleaved:\t%.3f us per image\n", interleaved * 1e6 / conversions);
+	if (mismatchCount > 0)
+	{
+		printf("%d images were encoded differently when interleaved.\n", mismatchCount);
+	}
+
+	for (int image = 0; image < imageCount; image++)
+	{
+		freeInputImage(&inputImages[image]);
+		free(outputImages[image].data);
+	}
+	for (int i = 0; i < list.count; i++)
+	{
+		free(list.files[i].sourceLocation);
+		free(list.files[i].relativeLocation);
+		free(list.files[i].exportLocation);
+	}
+	free(hashes);
+	free(inputImages);
+	free(outputImages);
+	free(list.files);
+}
+
+// Requests and responses of the daemon.
+// A request is a line of text followed by the data it describes:
+//		CONVERT <source length> <destination length> <data length> <options>\n<source><destination><data>
+// The options are the client's conversion options, as written by writeConversionOptions. Without them the daemon
+// converts with the options it was started with. The source is the location of the image to convert. If the data length is more than 0, the data is the image file
+// itself instead and the source is ignored. If the destination is empty, the QOI is sent back in the response,
+// otherwise it is saved to the destination.
+// The response is either:
+//		OK <QOI length>\n<QOI>		(the QOI length is 0 when it was saved to the destination)
+//		ERROR <message>\n
+// Any number of requests can be sent over one connection.
+
+// The longest source or destination location a request can have, and the largest image file it can send.
+// Anything longer is refused before any memory is reserved for it.
+#define DAEMON_MAX_LOCATION_LENGTH 4096
+#define DAEMON_MAX_DATA_LENGTH ((size_t)1 << 30)
+
+// Everything the daemon threads need.
+struct DaemonJob
+{
+	int socket;
+	struct Options *options;
+};
+
+// Reads exactly the given number of bytes from the socket. Returns false if the connection closed first.
+bool readSocket(int socket, void *data, size_t size)
+{
+	size_t received = 0;
+	while (received < size)
+	{
+		ssize_t result = read(socket, (char *)data + received, size - received);
+		if (result <= 0)
+		{
+			return false;
+		}
+		received += result;
+	}
+	return true;
+}
+
+// Writes all the bytes to the socket. Returns false if the connection closed first.
+bool writeSocket(int socket, const void *data, size_t size)
+{
+	size_t sent = 0;
+	while (sent < size)
+	{
+		ssize_t result = write(socket, (const char *)data + sent, size - sent);
+		if (result <= 0)
+		{
+			return false;
+		}
+		sent += result;
+	}
+	return true;
+}
+
+// Reads a line of text from the socket, without the new line. Returns false if the connection closed or the line is too long.
+bool readSocketLine(int socket, char *line, int maxLength)
+{
+	for (int i = 0; i < maxLength - 1; i++)
+	{
+		if (!readSocket(socket, &line[i], 1))
+		{
+			return false;
+		}
+		if (line[i] == '\n')
+		{
+			line[i] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
+
+// Makes sure a buffer has at least the given capacity, keeping it if it is already big enough.
+// Returns false if the memory could not be allocated, leaving the buffer empty.
+bool reserveBuffer(unsigned char **buffer, size_t *capacity, size_t size)
+{
+	if (*capacity < size)
+	{
+		free(*buffer);
+		*buffer = malloc(size);
+		*capacity = *buffer != NULL ? size : 0;
+	}
+	return *buffer != NULL;
+}
+
+// Handles one request on a connection. Returns false once the connection should be closed.
+// The request buffer and output image belong to the thread and are reused for every request,
+// so after the first few requests no new memory has to be allocated or faulted in for them.
+bool handleDaemonRequest(int client, struct Options *options, unsigned char **request, size_t *requestCapacity, struct OutputImage *outputImage)
+{
+	char line[256];
+	char conversionOptions[CONVERSION_OPTIONS_LENGTH];
+	size_t sourceLength, destinationLength, dataLength;
+	int fieldCount = 0;
+	if (readSocketLine(client, line, sizeof(line)))
+	{
+		fieldCount = sscanf(line, "CONVERT %zu %zu %zu %159s", &sourceLength, &destinationLength, &dataLength, conversionOptions);
+	}
+	if (fieldCount < 3)
+	{
+		return false;
+	}
+
+	// The lengths and options come from the client, so they are checked before they are used.
+	// The rest of the request can't be skipped, so the connection is closed after the error is sent.
+	char response[128];
+	struct Options requestOptions = *options;
+	if (fieldCount == 4 && !readConversionOptions(conversionOptions, &requestOptions))
+	{
+		sprintf(response, "ERROR Options are not valid.\n");
+		writeSocket(client, response, strlen(response));
+		return false;
+	}
+	if (sourceLength > DAEMON_MAX_LOCATION_LENGTH || destinationLength > DAEMON_MAX_LOCATION_LENGTH || dataLength > DAEMON_MAX_DATA_LENGTH)
+	{
+		sprintf(response, "ERROR Request is too large.\n");
+		writeSocket(client, response, strlen(response));
+		return false;
+	}
+
+	// The source and destination each have a null character added to the end so they can be used as strings.
+	size_t size = sourceLength + destinationLength + 2;
+	if (dataLength > SIZE_MAX - size || !reserveBuffer(request, requestCapacity, size + dataLength))
+	{
+		sprintf(response, "ERROR Not enough memory for the request.\n");
+		writeSocket(client, response, strlen(response));
+		return false;
+	}
+	char *source = (char *)*request;
+	char *destination = source + sourceLength + 1;
+	unsigned char *data = (unsigned char *)destination + destinationLength + 1;
+
+	if (!readSocket(client, source, sourceLength) || !readSocket(client, destination, destinationLength) || !readSocket(client, data, dataLength))
+	{
+		return false;
+	}
+	source[sourceLength] = '\0';
+	destination[destinationLength] = '\0';
+
+	char *error = NULL;
+	unsigned char *file = data;
+	size_t fileSize = dataLength;
+
+	// Read the source into memory if the image wasn't sent with the request.
+	if (dataLength == 0)
+	{
+		file = readFile(source, &fileSize);
+	}
+
+	if (file == NULL)
+	{
+		error = "Source file could not be read.";
+	}
+	else if (!convertFileToQOI(file, fileSize, outputImage, &requestOptions))
+	{
+		error = requestOptions.crop.width != 0 ? "Source file could not be decoded, or the crop starts outside it." : "Source file could not be decoded.";
+	}
+
+	if (file != data)
+	{
+		free(file);
+	}
+
+	if (error != NULL)
+	{
+		sprintf(response, "ERROR %s\n", error);
+		return writeSocket(client, response, strlen(response));
+	}
+
+	if (destinationLength > 0)
+	{
+		if (!exportQOI(destination, outputImage))
+		{
+			sprintf(response, "ERROR Destination could not be written.\n");
+			return writeSocket(client, response, strlen(response));
+		}
+		return writeSocket(client, "OK 0\n", 5);
+	}
+
+	sprintf(response, "OK %zu\n", outputImage->dataSize);
+	return writeSocket(client, response, strlen(response)) && writeSocket(client, outputImage->data, outputImage->dataSize);
+}
+
+// Thread function that accepts connections to the daemon and handles their requests, forever.
+// Every thread accepts from the same socket, so connections go to whichever thread is free.
+void *serveDaemonConnections(void *job)
+{
+	struct DaemonJob *daemonJob = job;
+
+	// Buffers kept for the life of the thread.
+	unsigned char *request = NULL;
+	size_t requestCapacity = 0;
+	struct OutputImage outputImage = {0};
+
+	while (true)
+	{
+		int client = accept(daemonJob->socket, NULL, NULL);
+		if (client < 0)
+		{
+			continue;
+		}
+
+		while (handleDaemonRequest(client, daemonJob->options, &request, &requestCapacity, &outputImage))
+		{
+		}
+
+		close(client);
+	}
+
+	return NULL;
+}
+
+// Fills in the address of a Unix domain socket. Returns false if the location is too long.
+bool getSocketAddress(char *socketLocation, struct sockaddr_un *address)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(socketLocation) >= sizeof(address->sun_path))
+	{
+		return false;
+	}
+	strcpy(address->sun_path, socketLocation);
+	return true;
+}
+
+// Runs as a daemon that converts images for other processes, listening on a Unix domain socket at the location.
+// Starting a process for every conversion costs more than converting a small image, so the daemon keeps its
+// threads and their buffers alive between conversions. Only returns if the socket can't be created.
+void startDaemon(char *socketLocation, struct Options *options)
+{
+	struct sockaddr_un address;
+	if (!getSocketAddress(socketLocation, &address))
+	{
+		printf("Socket location is too long.\n");
+		return;
+	}
+
+	struct DaemonJob job;
+	job.options = options;
+	job.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	// Remove the socket left by a previous daemon. Anything else at the location is left alone, and bind fails on it.
+	struct stat status;
+	if (lstat(socketLocation, &status) == 0 && S_ISSOCK(status.st_mode))
+	{
+		unlink(socketLocation);
+	}
+	if (job.socket < 0 || bind(job.socket, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		printf("Could not listen on %s.\n", socketLocation);
+		return;
+	}
+
+	// Any process that can connect can read and write files as this user, so only this user may connect.
+	if (chmod(socketLocation, 0600) != 0 || listen(job.socket, 64) != 0)
+	{
+		printf("Could not listen on %s.\n", socketLocation);
+		return;
+	}
+
+	// A client closing its connection early would otherwise stop the daemon when the response is written.
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Listening on %s with %d threads.\n", socketLocation, options->threadCount);
+	fflush(stdout);
+	runOnThreads(serveDaemonConnections, &job, options->threadCount);
+}
+
+// Sends a request to convert the source to the destination with the conversion options to the daemon listening at the
+// socket location.
+// Relative locations are sent as absolute locations, as the daemon may be running in another folder.
+// A source of "-" sends the image from stdin with the request, and a destination of "-" writes the QOI sent back to stdout.
+// Returns false and prints the reason to stderr if the conversion failed.
+bool requestDaemonConversion(char *socketLocation, char *importLocation, char *exportLocation, struct Options *options)
+{
+	struct sockaddr_un address;
+	if (!getSocketAddress(socketLocation, &address))
+	{
+		fprintf(stderr, "Socket location is too long.\n");
+		return false;
+	}
+
+	int client = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (client < 0 || connect(client, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "Could not connect to %s.\n", socketLocation);
+		if (client >= 0)
+		{
+			close(client);
+		}
+		return false;
+	}
+
+	char folder[4096];
+	if (getcwd(folder, sizeof(folder)) == NULL)
+	{
+		folder[0] = '\0';
+	}
+	// stdin and stdout aren't locations the daemon can use, so they are sent as empty locations.
+	bool standardSource = isStandardStream(importLocation);
+	bool standardDestination = isStandardStream(exportLocation);
+	char *source = importLocation[0] == '/' ? strdup(importLocation) : createString("%s/%s", folder, importLocation);
+	char *destination = exportLocation[0] == '/' ? strdup(exportLocation) : createString("%s/%s", folder, exportLocation);
+	if (standardSource)
+	{
+		source[0] = '\0';
+	}
+	if (standardDestination)
+	{
+		destination[0] = '\0';
+	}
+
+	// An image from stdin is sent as the data of the request. It can't be empty, as no data means the source is read instead.
+	unsigned char *data = NULL;
+	size_t dataLength = 0;
+	if (standardSource)
+	{
+		setBinaryMode(stdin);
+		data = readStream(stdin, &dataLength);
+		if (data == NULL || dataLength == 0)
+		{
+			fprintf(stderr, "Source file could not be read.\n");
+			free(data);
+			free(source);
+			free(destination);
+			close(client);
+			return false;
+		}
+	}
+
+	// The daemon converts with the options given to this process, not the ones it was started with.
+	char conversionOptions[CONVERSION_OPTIONS_LENGTH];
+	writeConversionOptions(options, conversionOptions, sizeof(conversionOptions));
+	char line[256];
+	sprintf(line, "CONVERT %zu %zu %zu %s\n", strlen(source), strlen(destination), dataLength, conversionOptions);
+	bool sent = writeSocket(client, line, strlen(line)) && writeSocket(client, source, strlen(source)) &&
+		writeSocket(client, destination, strlen(destination)) && writeSocket(client, data, dataLength);
+
+	bool converted = false;
+	size_t qoiLength;
+	if (sent && readSocketLine(client, line, sizeof(line)))
+	{
+		converted = sscanf(line, "OK %zu", &qoiLength) == 1;
+		if (!converted)
+		{
+			fprintf(stderr, "%s\n", line);
+		}
+		// Without a destination, the QOI follows the response line.
+		else if (standardDestination)
+		{
+			unsigned char *qoi = malloc(qoiLength);
+			setBinaryMode(stdout);
+			converted = qoi != NULL && readSocket(client, qoi, qoiLength) && fwrite(qoi, 1, qoiLength, stdout) == qoiLength && fflush(stdout) == 0;
+			if (!converted)
+			{
+				fprintf(stderr, "Destination file could not be written.\n");
+			}
+			free(qoi);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "No response from %s.\n", socketLocation);
+	}
+
+	free(data);
+	free(source);
+	free(destination);
+	close(client);
+	return converted;
+}
+
+// Times converting an image through the daemon against starting a new process of this program for each conversion.
+void benchmarkDaemon(char *importLocation, char *exportLocation, struct Options *options)
+{
+	double start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		if (!requestDaemonConversion(options->connectLocation, importLocation, exportLocation, options))
+		{
+			return;
+		}
+	}
+	double daemonSeconds = getSeconds() - start;
+
+	start = getSeconds();
+	for (int i = 0; i < options->benchmarkIterations; i++)
+	{
+		// The executable is found the same way the shell found it, through PATH when its name has no folder.
+		char *arguments[] = {options->executableLocation, "-s", importLocation, "-d", exportLocation, NULL};
+		pid_t process;
+		if (posix_spawnp(&process, options->executableLocation, NULL, NULL, arguments, environ) != 0)
+		{
+			printf("Could not start %s.\n", options->executableLocation);
+			return;
+		}
+		waitpid(process, NULL, 0);
+	}
+	double processSeconds = getSeconds() - start;
+
+	printf("Daemon:\t\t%.3f ms per image\n", daemonSeconds * 1000 / options->benchmarkIterations);
+	printf("New process:\t%.3f ms per image\n", processSeconds * 1000 / options->benchmarkIterations);
+}
+#endif
+
+char *getLocation(bool import)
+{
+	// Loop until information that is required has been provided.
+	while (true)
+	{
+		// Preallocate the space for the response.
+		char *location = malloc(sizeof(char) * 261);
+
+		// Different messages based on the required file.
+		if (import)
+		{
+			printf("Please enter the location of the file you would like to convert:\n");
+		}
+		else
+		{
+			printf("Please enter the location you wish to save as:\n");
+		}
+		// Get the string from the user and copy it to the memory allocated to location.
+		scanf("%s", location);
+
+		// If an import file is being gathered, check it exists.
+		// Allow through if not import file.
+		if (access(location, F_OK) != -1 || !import)
+		{
+			// Print the result text and return the location.
+			if (import)
+			{
+				printf("Imported");
+			}
+			else
+			{
+				printf("Exported");
+			}
+			printf(" file\n");
+			waitForInput();
+			return location;
+		}
+		else
+		{
+			// File not found, restart the loop.
+			printf("File not found. Try Again\n");
+			waitForInput();
+		}
+	}
+}
+
+// Sets every option to the value used when it isn't provided.
+void setDefaultOptions(struct Options *options)
+{
+	options->downConversion = DOWN_CONVERSION_ROUND;
+	options->tonemap = TONEMAP_REINHARD;
+	options->linear = false;
+	options->benchmarkIterations = 0;
+	options->frames = false;
+	options->delta = false;
+	options->verify = false;
+	options->targetSize = 0;
+	options->resizeWidth = 0;
+	options->resizeHeight = 0;
+	options->resizeFilter = RESIZE_BOX;
+	options->outputWidthCount = 0;
+	options->crop.x = 0;
+	options->crop.y = 0;
+	options->crop.width = 0;
+	options->crop.height = 0;
+	options->flip = false;
+	options->ignoreOrientation = false;
+	options->alphaTransform = ALPHA_KEEP;
+	options->stream = false;
+	options->rawWidth = 0;
+	options->rawHeight = 0;
+	options->pixelFormat = findPixelFormat("rgba");
+	options->threadCount = getProcessorCount();
+	options->daemonLocation = NULL;
+	options->connectLocation = NULL;
+	options->executableLocation = NULL;
+}
+
+// Determines if an arg is the given tag, in either its short or long form.
+bool isTag(char *arg, char *shortTag, char *longTag)
+{
+	return (shortTag != NULL && strcmp(arg, shortTag) == 0) || strcmp(arg, longTag) == 0;
+}
+
+// Reads the provided args and returns a code based on result.
+// -1 = Source File Does Not Exist
+// 0 = Incorrect Format
+// 1 = Success
+int readArgs(int argc, char *argv[], char *importLocation, char *exportLocation, struct Options *options)
+{
+	bool hasSource = false;
+	bool hasDestination = false;
+
+	// Arg 0 is executable.
+	// Every other arg is a parameter tag, followed by its value unless the tag is a flag, in any order.
+	for (int i = 1; i < argc; i++)
+	{
+		char *tag = argv[i];
+
+		// Flags don't have a value.
+		if (isTag(tag, NULL, "--frames"))
+		{
+			options->frames = true;
+			continue;
+		}
+		if (isTag(tag, NULL, "--flip"))
+		{
+			options->flip = true;
+			continue;
+		}
+		if (isTag(tag, NULL, "--ignore-orientation"))
+		{
+			options->ignoreOrientation = true;
+			continue;
+		}
+		if (isTag(tag, NULL, "--stream"))
+		{
+			options->stream = true;
+			continue;
+		}
+		if (isTag(tag, NULL, "--verify"))
+		{
+			options->verify = true;
+			continue;
+		}
+		if (isTag(tag, NULL, "--delta"))
+		{
+			// Delta encoding only applies to frames, so it turns them on too.
+			options->frames = true;
+			options->delta = true;
+			continue;
+		}
+
+		// Every other tag needs a value after it.
+		if (i + 1 >= argc)
+		{
+			// Incorrect Format.
+			return 0;
+		}
+
+		char *value = argv[i + 1];
+		i++;
+
+		if (isTag(tag, "-s", "--source"))
+		{
+			strcpy(importLocation, value);
+			hasSource = true;
+		}
+		else if (isTag(tag, "-d", "--destination"))
+		{
+			strcpy(exportLocation, value);
+			hasDestination = true;
+		}
+		else if (isTag(tag, NULL, "--depth"))
+		{
+			if (strcmp(value, "truncate") == 0)
+			{
+				options->downConversion = DOWN_CONVERSION_TRUNCATE;
+			}
+			else if (strcmp(value, "round") == 0)
+			{
+				options->downConversion = DOWN_CONVERSION_ROUND;
+			}
+			else if (strcmp(value, "dither") == 0)
+			{
+				options->downConversion = DOWN_CONVERSION_DITHER;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--tonemap"))
+		{
+			if (strcmp(value, "clamp") == 0)
+			{
+				options->tonemap = TONEMAP_CLAMP;
+			}
+			else if (strcmp(value, "reinhard") == 0)
+			{
+				options->tonemap = TONEMAP_REINHARD;
+			}
+			else if (strcmp(value, "aces") == 0)
+			{
+				options->tonemap = TONEMAP_ACES;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--colorspace"))
+		{
+			if (strcmp(value, "srgb") == 0)
+			{
+				options->linear = false;
+			}
+			else if (strcmp(value, "linear") == 0)
+			{
+				options->linear = true;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, "-t", "--threads"))
+		{
+			options->threadCount = atoi(value);
+			if (options->threadCount <= 0)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--size"))
+		{
+			options->targetSize = atoi(value);
+			if (options->targetSize <= 0)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--resize"))
+		{
+			// <width>x<height>, where either side can be 0 to keep the aspect ratio.
+			if (sscanf(value, "%dx%d", &options->resizeWidth, &options->resizeHeight) != 2 || options->resizeWidth < 0 || options->resizeHeight < 0)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--crop"))
+		{
+			struct Rectangle *crop = &options->crop;
+			if (sscanf(value, "%d,%d,%d,%d", &crop->x, &crop->y, &crop->width, &crop->height) != 4 || crop->x < 0 || crop->y < 0 || crop->width <= 0 || crop->height <= 0)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--raw"))
+		{
+			if (sscanf(value, "%dx%d", &options->rawWidth, &options->rawHeight) != 2 || options->rawWidth <= 0 || options->rawHeight <= 0 ||
+				options->rawWidth > STBI_MAX_DIMENSIONS || options->rawHeight > STBI_MAX_DIMENSIONS)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--pixel-format"))
+		{
+			options->pixelFormat = findPixelFormat(value);
+			if (options->pixelFormat == NULL)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--sizes"))
+		{
+			// A list of widths separated by commas.
+			options->outputWidthCount = 0;
+			char *next = value;
+			while (*next != '\0')
+			{
+				char *end;
+				long width = strtol(next, &end, 10);
+				if (end == next || width <= 0 || options->outputWidthCount == MAX_OUTPUT_SIZES || (*end != ',' && *end != '\0'))
+				{
+					return 0;
+				}
+				options->outputWidths[options->outputWidthCount] = width;
+				options->outputWidthCount++;
+				next = *end == ',' ? end + 1 : end;
+			}
+			if (options->outputWidthCount == 0)
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--filter"))
+		{
+			if (strcmp(value, "box") == 0)
+			{
+				options->resizeFilter = RESIZE_BOX;
+			}
+			else if (strcmp(value, "bilinear") == 0)
+			{
+				options->resizeFilter = RESIZE_BILINEAR;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--alpha"))
+		{
+			if (strcmp(value, "clear") == 0)
+			{
+				options->alphaTransform = ALPHA_CLEAR;
+			}
+			else if (strcmp(value, "premultiply") == 0)
+			{
+				options->alphaTransform = ALPHA_PREMULTIPLY;
+			}
+			else if (strcmp(value, "unpremultiply") == 0)
+			{
+				options->alphaTransform = ALPHA_UNPREMULTIPLY;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		else if (isTag(tag, NULL, "--daemon"))
+		{
+			options->daemonLocation = value;
+		}
+		else if (isTag(tag, NULL, "--connect"))
+		{
+			options->connectLocation = value;
+		}
+		else if (isTag(tag, "-b", "--benchmark"))
+		{
+			options->benchmarkIterations = atoi(value);
+			if (options->benchmarkIterations <= 0)
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			// Unknown tag.
+			return 0;
+		}
+	}
+
+	// A daemon gets its sources and destinations from its requests.
+	if (options->daemonLocation != NULL)
+	{
+		return 1;
+	}
+
+	// Both the source and destination are required.
+	if (!hasSource || !hasDestination)
+	{
+		return 0;
+	}
+
+	// stdin is always there to be read from.
+	if (isStandardStream(importLocation))
+	{
+		return 1;
+	}
+
+	// The access function determines if there is a file at the location.
+	// Check if it returns -1, if it does, return -1 (Error code for missing source)
+	// and if it doesn't, return success.
+	return access(importLocation, F_OK) == -1 ? -1 : 1;
+}
+
+void startMenu()
+{
+	printf("Welcome to Encode QOI.\n");
+
+	// Preallocate the maximum space for the location string.
+	char *importLocation = malloc(sizeof(char) * 261);
+	// Copy the value of getLocation to the memory allocated previously.
+	strcpy(importLocation, getLocation(true));
+
+	// The menu doesn't ask for any options, so the defaults are used.
+	struct Options options;
+	setDefaultOptions(&options);
+
+	// Creates an empty output image to be filled.
+	struct OutputImage outputImage = {0};
+	// Converts the image located at the file location inputted previously into the output image.
+	if (!convertImageToQOI(importLocation, &outputImage, &options))
+	{
+		printf("Source file could not be decoded.\n");
+		free(outputImage.data);
+		free(importLocation);
+		return;
+	}
+
+	// Get the intended location for the export.
 	// Must allocate memory space first.
 	char *exportLocation = malloc(sizeof(char) * 261);
 	strcpy(exportLocation, getLocation(false));
 
 	// Export the image to the given location.
-	exportQOI(exportLocation, &outputImage);
+	if (!exportQOI(exportLocation, &outputImage))
+	{
+		printf("Destination file could not be written.\n");
+	}
 
 	// Free up the allocated memory.
 	free(outputImage.data);
@@ -555,34 +8053,157 @@ void startCommandLine(int argc, char *argv[])
 	char *importLocation = malloc(sizeof(char) * 261);
 	char *exportLocation = malloc(sizeof(char) * 261);
 
-	int argResult = readArgs(argc, argv, importLocation, exportLocation);
+	struct Options options;
+	setDefaultOptions(&options);
 
-	if (argResult == 1)
+	options.executableLocation = argv[0];
+
+	int argResult = readArgs(argc, argv, importLocation, exportLocation, &options);
+
+	if (argResult == 1 && (options.daemonLocation != NULL || options.connectLocation != NULL))
+	{
+#ifdef _WIN32
+		printf("The daemon is not available on Windows.\n");
+#else
+		if (options.daemonLocation != NULL)
+		{
+			startDaemon(options.daemonLocation, &options);
+		}
+		else if (options.benchmarkIterations > 0)
+		{
+			benchmarkDaemon(importLocation, exportLocation, &options);
+		}
+		else
+		{
+			requestDaemonConversion(options.connectLocation, importLocation, exportLocation, &options);
+		}
+#endif
+	}
+	else if (argResult == 1)
 	{
 		// Similar to the menu script but doesn't have steps in between to get other information.
 
-		struct InputImage inputImage;
-		// Import the image located at the file location inputted previously.
-		importImage(importLocation, &inputImage);
+		// A folder as the source converts every image within it to the destination folder.
+		struct stat status;
+		if (stat(importLocation, &status) == 0 && S_ISDIR(status.st_mode))
+		{
+#ifdef _WIN32
+			printf("Converting folders is not available on Windows.\n");
+#else
+			if (options.benchmarkIterations > 0)
+			{
+				benchmarkFolderConversion(importLocation, exportLocation, &options);
+			}
+			convertFolder(importLocation, exportLocation, &options);
+#endif
+			free(exportLocation);
+			free(importLocation);
+			return;
+		}
+
+		if (options.benchmarkIterations > 0)
+		{
+			benchmarkConversion(importLocation, &options);
+		}
+
+		// Animated GIFs are saved as one file per frame, so they don't follow the single image steps below.
+		if (options.frames)
+		{
+			convertGIFFrames(importLocation, exportLocation, &options);
+			free(exportLocation);
+			free(importLocation);
+			return;
+		}
+
+		// An image saved at several sizes is decoded once and saved as one file per size.
+		if (options.outputWidthCount > 0)
+		{
+			convertImageSizes(importLocation, exportLocation, &options);
+			free(exportLocation);
+			free(importLocation);
+			return;
+		}
+
+		// Raw pixels and PNM images are streamed, and a streamed image is flipped by reading it a batch of rows at a
+		// time from the bottom up, so it has to come from a source that can be seeked. This is checked first, as a pipe
+		// can't be read again once it has started. Only the first byte is read to find the format, and it's put back.
+		bool resizing = options.resizeWidth != 0 || options.resizeHeight != 0;
+		bool streamedFromPipe = false;
+		if (options.flip && isStandardStream(importLocation) && (options.stream || options.rawWidth != 0) && !resizing && ftello(stdin) < 0)
+		{
+			setBinaryMode(stdin);
+			int first = getc(stdin);
+			ungetc(first, stdin);
+			streamedFromPipe = options.rawWidth != 0 || first == 'P';
+		}
+		if (streamedFromPipe)
+		{
+			fprintf(stderr, "A streamed image can't be flipped when it comes from a pipe. Save it to a file first.\n");
+			free(exportLocation);
+			free(importLocation);
+			return;
+		}
 
 		// Creates an empty output image to be filled.
-		struct OutputImage outputImage;
-		// Converts the input image into an output image.
-		// Passing both input and output image by reference
-		convertToQOI(&inputImage, &outputImage);
+		struct OutputImage outputImage = {0};
+
+		// A destination of "-" writes the image to stdout while it is being encoded,
+		// so the next program in a pipe can start reading before the encode is done.
+		// With the stream option, a file destination is written the same way so the output isn't kept in memory.
+		bool streamed = isStandardStream(exportLocation);
+		FILE *destination = NULL;
+		if (streamed)
+		{
+			setBinaryMode(stdout);
+			outputImage.stream = stdout;
+		}
+		else if (options.stream)
+		{
+			destination = fopen(exportLocation, "wb");
+			if (destination == NULL)
+			{
+				fprintf(stderr, "Destination file could not be opened.\n");
+				free(exportLocation);
+				free(importLocation);
+				return;
+			}
+			outputImage.stream = destination;
+			streamed = true;
+		}
+
+		// Converts the image located at the file location inputted previously into the output image.
+		if (!convertImageToQOI(importLocation, &outputImage, &options))
+		{
+			// Errors go to stderr so they don't end up in an image being written to stdout.
+			fprintf(stderr, options.crop.width != 0 ? "Source file could not be decoded, or the crop starts outside it.\n" : "Source file could not be decoded.\n");
+			// A file that was written as it was encoded only holds part of an image.
+			if (destination != NULL)
+			{
+				fclose(destination);
+				remove(exportLocation);
+			}
+			free(outputImage.data);
+			free(exportLocation);
+			free(importLocation);
+			return;
+		}
 
 		// Export the image to the given location.
-		exportQOI(exportLocation, &outputImage);
+		if (destination != NULL)
+		{
+			fclose(destination);
+		}
+		else if (!streamed && !exportQOI(exportLocation, &outputImage))
+		{
+			fprintf(stderr, "Destination file could not be written.\n");
+		}
 
-		// Free up input image memory.
-		free(inputImage.pixels);
-		free(inputImage.fileLocation);
 		free(outputImage.data);
 		free(outputImage.fileLocation);
 	}
 	else if (argResult == -1)
 	{
-		printf("Source file does not exist.\n");
+		fprintf(stderr, "Source file does not exist.\n");
 	}
 	else if (argResult == 0)
 	{
@@ -600,6 +8221,36 @@ void startCommandLine(int argc, char *argv[])
 		printf("  -h --help\t\t\t\t\tShow this screen.\n");
 		printf("  (-s | --source) <source file>\t\t\tSet the source file\n");
 		printf("  (-d | --destination) <destination file>\tSet the destination file\n");
+		printf("  \t\t\t\t\t\tIf the source is a folder, every image in it is converted into the destination folder\n");
+		printf("  \t\t\t\t\t\tA source of - reads from stdin, a destination of - writes to stdout\n");
+		printf("  --verify\t\t\t\t\tWhen converting a folder, check file contents instead of only size and modified time\n");
+		printf("  --depth (truncate | round | dither)\t\tHow 16 bit images are reduced to 8 bits (default round)\n");
+		printf("  --tonemap (clamp | reinhard | aces)\t\tHow HDR images are reduced to 8 bits (default reinhard)\n");
+		printf("  --colorspace (srgb | linear)\t\t\tSave HDR images without gamma as linear (default srgb)\n");
+		printf("  --frames\t\t\t\t\tSave every frame of a GIF as <destination>_0000.qoi, <destination>_0001.qoi, ...\n");
+		printf("  --delta\t\t\t\t\tLike --frames, but only save what changed in each frame, listed in <destination>.txt\n");
+		printf("  --size <pixels>\t\t\t\tDecode JPEGs at 1/2, 1/4 or 1/8 size while the longer side stays at least this long\n");
+		printf("  --crop <x>,<y>,<width>,<height>\t\tOnly encode this rectangle of the upright image. It must start\n");
+		printf("  \t\t\t\t\t\twithin the image, and is cut down if it runs past it\n");
+		printf("  --flip\t\t\t\t\tEncode the image upside down\n");
+		printf("  --ignore-orientation\t\t\t\tEncode JPEGs as they are stored instead of turning them upright\n");
+		printf("  --alpha (clear | premultiply | unpremultiply)\tApply the alpha of each pixel to its color. clear only sets\n");
+		printf("  \t\t\t\t\t\tfully transparent pixels to black, which the others also do\n");
+		printf("  --raw <width>x<height>\t\t\tRead the source as pixels with no header\n");
+		printf("  --pixel-format <format>\t\t\tThe byte order of raw pixels (default rgba)\n");
+		printf("  \t\t\t\t\t\trgba, bgra, argb, abgr, rgbx, bgrx, xrgb, xbgr, rgb or bgr\n");
+		printf("  --stream\t\t\t\t\tRead raw and PNM sources a batch of rows at a time and write the destination as it is encoded\n");
+		printf("  \t\t\t\t\t\tfor images larger than memory\n");
+		printf("  --resize <width>x<height>\t\t\tResize images before encoding, with 0 for a side keeping the aspect ratio\n");
+		printf("  --sizes <width>,<width>,...\t\t\tSave the image at each width as <destination>_<width>.qoi, from one decode\n");
+		printf("  --filter (box | bilinear)\t\t\tHow images are resized (default box)\n");
+		printf("  (-t | --threads) <count>\t\t\tThe number of threads to use (default one per processor)\n");
+		printf("  --daemon <socket>\t\t\t\tListen on a Unix domain socket and convert images sent to it\n");
+		printf("  --connect <socket>\t\t\t\tSend the conversion to the daemon listening on the socket, which converts\n");
+		printf("  \t\t\t\t\t\twith the options given here\n");
+		printf("  (-b | --benchmark) <iterations>\t\tTime the conversion against stb_image's own 8 bit conversion\n");
+		printf("  \t\t\t\t\t\tWith --connect, time the daemon against starting a new process for each image\n");
+		printf("  \t\t\t\t\t\tWith a folder, time encoding its images one at a time against several at once\n");
 	}
 	// Free up the allocated memory.
 	free(exportLocation);